@@ -19,6 +19,11 @@
 #define set_led_cyan    red_led_off; grn_led_on;  blu_led_on
 #define set_led_white   red_led_on;  grn_led_on;  blu_led_on
 
+#ifdef CONSOLE_ENABLE
+// Prints the receiver's telemetry and latency histograms to the console.
+void matrix_print_telemetry(void);
+#endif
+
 /*
 #define LED_B 5
 #define LED_R 6
@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #if defined(__AVR__)
 #include <avr/io.h>
 #endif
@@ -47,6 +48,62 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 /* matrix state(1:on, 0:off) */
 static matrix_row_t matrix[MATRIX_ROWS];
 
+#ifdef CONSOLE_ENABLE
+//while debug is on, the receiver's telemetry is printed this often (ms)
+#define TELEMETRY_INTERVAL 10000
+
+//replies to the diagnostic commands start with this instead of key data
+#define REPORT_START 0xE1
+
+//the receiver's reply to 't', little endian like the AVR
+typedef struct {
+    uint32_t packets;
+    uint32_t cmac_fail;
+    uint32_t decrypt_fail;
+    uint32_t skipped;
+    uint32_t replayed;
+    uint8_t rekey_state;
+    uint8_t key_id;
+    uint8_t new_key_id;
+    uint8_t key_id_confirmed;
+    //the half's own statistics, see mitosis_telemetry_value_t
+    uint32_t telemetry_packets;
+    uint32_t tx_count;
+    uint32_t tx_fail;
+    uint32_t rtx_count;
+    uint32_t max_rtx;
+    uint32_t rekey_cmac_success;
+    uint32_t rekey_cmac_failure;
+    uint32_t rekey_decrypt_failure;
+    uint32_t crypto_failure;
+    uint32_t report_overflows;
+    uint32_t report_high_water;
+} keyboard_telemetry_t;
+
+typedef struct {
+    keyboard_telemetry_t halves[2];
+    uint32_t rx_overflows;
+    uint32_t rx_high_water;
+    uint32_t ecb_blocks;
+    uint32_t ecb_wakeups;
+    uint32_t rekey_steps;
+    uint32_t rekey_step_max;
+} receiver_telemetry_t;
+
+//one of the four latency histograms in the reply to 'l', in microseconds;
+//bucket 0 is under 32us and each bucket after that is twice as wide
+typedef struct {
+    uint32_t count;
+    uint32_t sum;
+    uint32_t max;
+    uint16_t buckets[16];
+} latency_histogram_t;
+
+static uint16_t telemetry_timer;
+void matrix_print_telemetry(void);
+static uint8_t report_body[4 * sizeof(latency_histogram_t)];
+#endif
+
 __attribute__ ((weak))
 void matrix_init_quantum(void) {
     matrix_init_kb();
@@ -127,10 +184,106 @@ uint8_t matrix_scan(void)
     }
 
 
+#ifdef CONSOLE_ENABLE
+    if (debug_enable && timer_elapsed(telemetry_timer) > TELEMETRY_INTERVAL) {
+        telemetry_timer = timer_read();
+        matrix_print_telemetry();
+    }
+#endif
+
     matrix_scan_quantum();
     return 1;
 }
 
+#ifdef CONSOLE_ENABLE
+static bool uart_read(uint8_t *byte)
+{
+    uint32_t timeout = 0;
+
+    while(!SERIAL_UART_RXD_PRESENT){
+        timeout++;
+        if (timeout > 10000){
+            return false;
+        }
+    }
+    *byte = SERIAL_UART_DATA;
+    return true;
+}
+
+//sends a diagnostic command to the receiver and reads the reply into
+//report_body: a start byte, the command, the body length, the body, then
+//an xor of everything before it. returns the body length, or -1
+static int16_t uart_request(uint8_t command)
+{
+    uint8_t header[3];
+    uint8_t checksum = 0;
+    uint8_t byte;
+
+    SERIAL_UART_DATA = command;
+    for (uint8_t i = 0; i < 3; i++) {
+        if (!uart_read(&header[i])) {
+            return -1;
+        }
+        checksum ^= header[i];
+    }
+    if (header[0] != REPORT_START || header[1] != command || header[2] > sizeof(report_body)) {
+        return -1;
+    }
+    for (uint8_t i = 0; i < header[2]; i++) {
+        if (!uart_read(&report_body[i])) {
+            return -1;
+        }
+        checksum ^= report_body[i];
+    }
+    if (!uart_read(&byte) || byte != checksum) {
+        return -1;
+    }
+    return header[2];
+}
+
+void matrix_print_telemetry(void)
+{
+    static const char *stages[4] = { "left kb", "left rx", "right kb", "right rx" };
+    receiver_telemetry_t telemetry;
+    latency_histogram_t histogram;
+
+    if (uart_request('t') != sizeof(telemetry)) {
+        print("mitosis: no telemetry\n");
+        return;
+    }
+    memcpy(&telemetry, report_body, sizeof(telemetry));
+    for (uint8_t i = 0; i < 2; i++) {
+        keyboard_telemetry_t *half = &telemetry.halves[i];
+        xprintf("%s: %lu packets, %lu cmac fail, %lu decrypt fail, %lu skipped, %lu replayed, key %u next %u%s, rekey state %u\n",
+                i ? "right" : "left", half->packets, half->cmac_fail, half->decrypt_fail, half->skipped, half->replayed,
+                half->key_id, half->new_key_id, half->key_id_confirmed ? "" : " (unconfirmed)",
+                half->rekey_state);
+        xprintf("  %lu telemetry: %lu sent, %lu failed, %lu attempts (max %lu), rekey %lu ok %lu bad mac %lu bad seed, "
+                "%lu crypto fail, %lu overflows (high water %lu)\n",
+                half->telemetry_packets, half->tx_count, half->tx_fail, half->rtx_count, half->max_rtx,
+                half->rekey_cmac_success, half->rekey_cmac_failure, half->rekey_decrypt_failure,
+                half->crypto_failure, half->report_overflows, half->report_high_water);
+    }
+    xprintf("rx overflows %lu, high water %lu, ecb blocks %lu, ecb wakeups %lu, rekey steps %lu (max %luus)\n",
+            telemetry.rx_overflows, telemetry.rx_high_water, telemetry.ecb_blocks, telemetry.ecb_wakeups,
+            telemetry.rekey_steps, telemetry.rekey_step_max);
+
+    if (uart_request('l') != sizeof(report_body)) {
+        print("mitosis: no latency\n");
+        return;
+    }
+    for (uint8_t i = 0; i < 4; i++) {
+        memcpy(&histogram, report_body + i * sizeof(histogram), sizeof(histogram));
+        xprintf("%s: %lu, mean %lu max %lu us:", stages[i], histogram.count,
+                histogram.count ? histogram.sum / histogram.count : 0, histogram.max);
+        for (uint8_t j = 0; j < 16; j++) {
+            xprintf(" %u", histogram.buckets[j]);
+        }
+        print("\n");
+    }
+}
+#endif
+
 inline
 bool matrix_is_on(uint8_t row, uint8_t col)
 {
@@ -3,6 +3,17 @@
 #include <string.h>
 #include "mitosis-aes-ctr.h"
 
+// The keystream ring is filled from thread mode and drained from interrupts,
+// so publishing a block has to be atomic with respect to the consumer.
+#ifdef UNIX
+#define KEYSTREAM_LOCK(state) (void) (state = 0)
+#define KEYSTREAM_UNLOCK(state) (void) (state)
+#else
+#include <nrf.h>
+#define KEYSTREAM_LOCK(state) state = __get_PRIMASK(); __disable_irq()
+#define KEYSTREAM_UNLOCK(state) __set_PRIMASK(state)
+#endif
+
 bool mitosis_aes_ctr_init(const uint8_t* key, const uint8_t* nonce, mitosis_encrypt_context_t* context)
 {
     memset(context, 0, sizeof(*context));
@@ -11,6 +22,108 @@ bool mitosis_aes_ctr_init(const uint8_t* key, const uint8_t* nonce, mitosis_encr
     return mitosis_aes_ecb_init(&context->ecb);
 }
 
+void mitosis_aes_ctr_keystream_reset(mitosis_aes_ctr_keystream_t* keystream)
+{
+    uint32_t primask;
+
+    KEYSTREAM_LOCK(primask);
+    keystream->count = 0;
+    keystream->head = 0;
+    ++keystream->generation;
+    KEYSTREAM_UNLOCK(primask);
+}
+
+bool mitosis_aes_ctr_precompute(const mitosis_encrypt_context_t* context, mitosis_aes_ctr_keystream_t* keystream)
+{
+    uint8_t generation;
+    uint32_t counter;
+    bool published = false;
+    uint32_t primask;
+
+    KEYSTREAM_LOCK(primask);
+    generation = keystream->generation;
+    if (keystream->count == 0)
+    {
+        counter = context->ctr.iv.counter;
+    }
+    else
+    {
+        counter = keystream->first_counter + keystream->count;
+    }
+    published = keystream->count < MITOSIS_CTR_KEYSTREAM_BLOCKS;
+    KEYSTREAM_UNLOCK(primask);
+
+    if (!published)
+    {
+        return false;
+    }
+
+    memcpy(keystream->ecb.key, context->ctr.key, sizeof(keystream->ecb.key));
+    memcpy(keystream->ecb.plaintext, context->ctr.iv_bytes, sizeof(keystream->ecb.plaintext));
+    ((mitosis_aes_ctr_context_t*) &keystream->ecb)->iv.counter = counter;
+    if (!mitosis_aes_ecb_encrypt(&keystream->ecb))
+    {
+        return false;
+    }
+
+    // Only publish if nothing was reset or consumed out of order while the
+    // block was being computed.
+    KEYSTREAM_LOCK(primask);
+    published = false;
+    if (keystream->generation == generation)
+    {
+        if (keystream->count == 0 && context->ctr.iv.counter == counter)
+        {
+            keystream->head = 0;
+            keystream->first_counter = counter;
+            published = true;
+        }
+        else if (keystream->count != 0 && keystream->first_counter + keystream->count == counter)
+        {
+            published = true;
+        }
+    }
+    if (published)
+    {
+        uint8_t slot = (keystream->head + keystream->count) % MITOSIS_CTR_KEYSTREAM_BLOCKS;
+        memcpy(keystream->blocks[slot], keystream->ecb.ciphertext, AES_BLOCK_SIZE);
+        ++keystream->count;
+    }
+    KEYSTREAM_UNLOCK(primask);
+
+    return published;
+}
+
+// Copies the precomputed block for the current counter into scratch, if there is one.
+static inline
+bool consume_keystream(mitosis_encrypt_context_t* context, mitosis_aes_ctr_keystream_t* keystream)
+{
+    bool found = false;
+    uint32_t primask;
+
+    KEYSTREAM_LOCK(primask);
+    if (keystream->count != 0)
+    {
+        if (keystream->first_counter == context->ctr.iv.counter)
+        {
+            memcpy(context->ctr.scratch, keystream->blocks[keystream->head], AES_BLOCK_SIZE);
+            keystream->head = (keystream->head + 1) % MITOSIS_CTR_KEYSTREAM_BLOCKS;
+            ++keystream->first_counter;
+            --keystream->count;
+            found = true;
+        }
+        else
+        {
+            // The counter jumped; nothing in the ring is useful any more.
+            keystream->count = 0;
+            ++keystream->generation;
+        }
+    }
+    KEYSTREAM_UNLOCK(primask);
+
+    return found;
+}
+
 static inline
 void xor(const uint8_t* left, const uint8_t* right, size_t len, uint8_t* out)
 {
@@ -46,3 +159,19 @@ bool mitosis_aes_ctr_encrypt(mitosis_encrypt_context_t* context, uint32_t datale
 
     return true;
 }
+
+bool mitosis_aes_ctr_encrypt_keystream(mitosis_encrypt_context_t* context, mitosis_aes_ctr_keystream_t* keystream, uint32_t datalen, const uint8_t* plaintext, uint8_t* ciphertext)
+{
+    if (datalen > AES_BLOCK_SIZE)
+    {
+        return false;
+    }
+
+    if (!consume_keystream(context, keystream))
+    {
+        return mitosis_aes_ctr_encrypt(context, datalen, plaintext, ciphertext);
+    }
+    xor(plaintext, context->ctr.scratch, datalen, ciphertext);
+
+    return true;
+}
@@ -22,6 +22,30 @@ typedef union _mitosis_encrypt_context_t {
     mitosis_aes_ctr_context_t ctr;
 } mitosis_encrypt_context_t;
 
+/*
+Number of keystream blocks that can be computed ahead of the counter.
+*/
+#ifndef MITOSIS_CTR_KEYSTREAM_BLOCKS
+#define MITOSIS_CTR_KEYSTREAM_BLOCKS 4
+#endif
+
+/*
+Keystream blocks computed ahead of a CTR context's counter. Kept apart from
+mitosis_encrypt_context_t so only the context that sends gets to pay for it.
+A zeroed ring is empty.
+*/
+typedef struct _mitosis_aes_ctr_keystream_t {
+    // Separate ECB context so precomputing never touches the live IV.
+    mitosis_aes_ecb_context_t ecb;
+    uint8_t blocks[MITOSIS_CTR_KEYSTREAM_BLOCKS][AES_BLOCK_SIZE];
+    // Counter value that blocks[head] was generated for.
+    volatile uint32_t first_counter;
+    volatile uint8_t head;
+    volatile uint8_t count;
+    // Bumped on every reset so in-flight precomputation can be discarded.
+    volatile uint8_t generation;
+} mitosis_aes_ctr_keystream_t;
+
 /*
 Key and nonce are 16 bytes for consistency.
 */
@@ -29,4 +53,23 @@ bool mitosis_aes_ctr_init(const uint8_t* key, const uint8_t* nonce, mitosis_encr
 
 bool mitosis_aes_ctr_encrypt(mitosis_encrypt_context_t* context, uint32_t datalen, const uint8_t* plaintext, uint8_t* ciphertext);
 
+/*
+Same as mitosis_aes_ctr_encrypt(), but XORs in the block from keystream when
+one was precomputed for the current counter.
+*/
+bool mitosis_aes_ctr_encrypt_keystream(mitosis_encrypt_context_t* context, mitosis_aes_ctr_keystream_t* keystream, uint32_t datalen, const uint8_t* plaintext, uint8_t* ciphertext);
+
+/*
+Computes the keystream block for the next counter value of context not yet in
+the ring. Meant to be called from idle time.
+Returns false when the ring is full or the block couldn't be computed.
+*/
+bool mitosis_aes_ctr_precompute(const mitosis_encrypt_context_t* context, mitosis_aes_ctr_keystream_t* keystream);
+
+/*
+Discards all precomputed keystream. Must be called whenever the key or nonce
+of the context the ring belongs to are changed.
+*/
+void mitosis_aes_ctr_keystream_reset(mitosis_aes_ctr_keystream_t* keystream);
+
 #define mitosis_aes_ctr_decrypt(context, datalen, ciphertext, plaintext) mitosis_aes_ctr_encrypt(context, datalen, ciphertext, plaintext)
@@ -5,10 +5,24 @@
 #include "mitosis-aes-ecb.h"
 
 #define ENCRYPT_WAIT 0x1000000
+// Wakeups thread mode sleeps through before giving up on a request. Each block
+// queued ahead of it wakes the CPU once with its ECB interrupt, so this covers
+// a long queue plus any other interrupts that arrive while it drains.
+#define ENCRYPT_WAIT_WAKEUPS 256
+#define ECB_IRQ_PRIORITY 3
+// Requests queued at once by mitosis_aes_ecb_encrypt_batch().
+#define BATCH_CHUNK 4
 
-static uint32_t wait_counts = 0;
+#define QUEUE_LOCK() uint32_t primask = __get_PRIMASK(); __disable_irq()
+#define QUEUE_UNLOCK() __set_PRIMASK(primask)
+
+static uint32_t wakeup_counts = 0;
 static uint32_t encrypt_count = 0;
 
+static mitosis_aes_ecb_request_t* volatile queue_head = NULL;
+static mitosis_aes_ecb_request_t* volatile queue_tail = NULL;
+static bool irq_enabled = false;
+
 bool mitosis_aes_ecb_init(mitosis_aes_ecb_context_t* state)
 {
     if (state == NULL)
@@ -16,42 +30,228 @@ bool mitosis_aes_ecb_init(mitosis_aes_ecb_context_t* state)
         return false;
     }
 
-    NRF_ECB->ECBDATAPTR = (uint32_t) state;
+    if (!irq_enabled)
+    {
+        NRF_ECB->INTENSET = ECB_INTENSET_ENDECB_Msk | ECB_INTENSET_ERRORECB_Msk;
+        NVIC_SetPriority(ECB_IRQn, ECB_IRQ_PRIORITY);
+        NVIC_ClearPendingIRQ(ECB_IRQn);
+        NVIC_EnableIRQ(ECB_IRQn);
+        irq_enabled = true;
+    }
     return true;
 }
 
-bool mitosis_aes_ecb_encrypt(mitosis_aes_ecb_context_t* state)
+// Must be called with interrupts disabled.
+static inline
+void start_head(void)
 {
-    if (state == NULL)
+    NRF_ECB->EVENTS_ENDECB = 0;
+    NRF_ECB->EVENTS_ERRORECB = 0;
+    NRF_ECB->ECBDATAPTR = (uintptr_t) queue_head->state;
+    NRF_ECB->TASKS_STARTECB = 1;
+}
+
+bool mitosis_aes_ecb_encrypt_async(mitosis_aes_ecb_request_t* request)
+{
+    if (request == NULL || !mitosis_aes_ecb_init(request->state))
     {
         return false;
     }
 
-    if (NRF_ECB->ECBDATAPTR != (uint32_t) state)
+    request->done = false;
+    request->success = false;
+    request->next = NULL;
+
+    QUEUE_LOCK();
+    if (queue_tail == NULL)
     {
-        NRF_ECB->ECBDATAPTR = (uint32_t) state;
+        queue_head = queue_tail = request;
+        start_head();
     }
+    else
+    {
+        queue_tail->next = request;
+        queue_tail = request;
+    }
+    QUEUE_UNLOCK();
+    return true;
+}
 
+bool mitosis_aes_ecb_service(void)
+{
+    mitosis_aes_ecb_request_t* completed = NULL;
+
+    QUEUE_LOCK();
+    if (NRF_ECB->EVENTS_ENDECB || NRF_ECB->EVENTS_ERRORECB)
+    {
+        completed = queue_head;
+        if (completed != NULL)
+        {
+            completed->success = !NRF_ECB->EVENTS_ERRORECB;
+            ++encrypt_count;
+            queue_head = completed->next;
+        }
+        if (queue_head == NULL)
+        {
+            queue_tail = NULL;
+            NRF_ECB->EVENTS_ENDECB = 0;
+            NRF_ECB->EVENTS_ERRORECB = 0;
+        }
+        else
+        {
+            start_head();
+        }
+    }
+    QUEUE_UNLOCK();
+
+    if (completed == NULL)
+    {
+        return false;
+    }
+    if (completed->callback != NULL)
+    {
+        completed->callback(completed);
+    }
+    completed->done = true;
+    return true;
+}
+
+bool mitosis_aes_ecb_busy(void)
+{
+    return queue_head != NULL;
+}
+
+void ECB_IRQHandler(void)
+{
+    mitosis_aes_ecb_service();
+}
+
+// Pulls a request that timed out back out of the queue, so its storage can
+// be released. Stops the peripheral if the request was in flight.
+static void cancel(mitosis_aes_ecb_request_t* request)
+{
+    QUEUE_LOCK();
+    if (queue_head == request)
+    {
+        NRF_ECB->TASKS_STOPECB = 1;
+        queue_head = request->next;
+        if (queue_head == NULL)
+        {
+            queue_tail = NULL;
+        }
+        else
+        {
+            start_head();
+        }
+    }
+    else
+    {
+        mitosis_aes_ecb_request_t* prev = queue_head;
+        while (prev != NULL && prev->next != request)
+        {
+            prev = prev->next;
+        }
+        if (prev != NULL)
+        {
+            prev->next = request->next;
+            if (queue_tail == request)
+            {
+                queue_tail = prev;
+            }
+        }
+    }
+    QUEUE_UNLOCK();
+}
+
+// Waits for a queued request. Thread mode sleeps until the ECB interrupt
+// completes it. Interrupt handlers (which may be masking the ECB interrupt)
+// and code running with interrupts disabled service the queue themselves.
+static bool wait_for(mitosis_aes_ecb_request_t* request)
+{
     uint32_t wait_counter = ENCRYPT_WAIT;
+    uint32_t wakeups = 0;
 
-    NRF_ECB->EVENTS_ERRORECB = 0;
-    NRF_ECB->EVENTS_ENDECB = 0;
-    NRF_ECB->TASKS_STARTECB = 1;
-    while (!(NRF_ECB->EVENTS_ENDECB | NRF_ECB->EVENTS_ERRORECB))
+    while (!request->done)
     {
-        wait_counter--;
-        if(wait_counter == 0)
+        if (__get_IPSR() == 0 && __get_PRIMASK() == 0)
         {
+            __WFE();
+            ++wakeups;
+        }
+        else
+        {
+            mitosis_aes_ecb_service();
+            --wait_counter;
+        }
+        if (wakeups == ENCRYPT_WAIT_WAKEUPS || wait_counter == 0)
+        {
+            cancel(request);
             return false;
         }
     }
-    ++encrypt_count;
-    wait_counts += (ENCRYPT_WAIT - wait_counter);
-    NRF_ECB->EVENTS_ENDECB = 0;
-    if (NRF_ECB->EVENTS_ERRORECB)
+    wakeup_counts += wakeups;
+    return request->success;
+}
+
+bool mitosis_aes_ecb_encrypt(mitosis_aes_ecb_context_t* state)
+{
+    mitosis_aes_ecb_request_t request = { .state = state };
+
+    if (!mitosis_aes_ecb_encrypt_async(&request))
+    {
+        return false;
+    }
+    return wait_for(&request);
+}
+
+bool mitosis_aes_ecb_encrypt_batch(mitosis_aes_ecb_context_t* const states[], size_t count)
+{
+    mitosis_aes_ecb_request_t requests[BATCH_CHUNK] = { { 0 } };
+
+    if (states == NULL)
     {
-        NRF_ECB->EVENTS_ERRORECB = 0;
         return false;
     }
+
+    // Validate everything up front so a bad entry can't leave the batch half done.
+    for (size_t idx = 0; idx < count; ++idx)
+    {
+        if (states[idx] == NULL)
+        {
+            return false;
+        }
+    }
+
+    // Queue a chunk at a time so the peripheral moves straight on to the
+    // next block from the interrupt, instead of waiting to be restarted.
+    for (size_t base = 0; base < count; base += BATCH_CHUNK)
+    {
+        size_t chunk = count - base < BATCH_CHUNK ? count - base : BATCH_CHUNK;
+        bool success = true;
+
+        for (size_t idx = 0; idx < chunk; ++idx)
+        {
+            requests[idx].state = states[base + idx];
+            mitosis_aes_ecb_encrypt_async(&requests[idx]);
+        }
+        for (size_t idx = 0; idx < chunk; ++idx)
+        {
+            success &= wait_for(&requests[idx]);
+        }
+        if (!success)
+        {
+            return false;
+        }
+    }
     return true;
 }
+
+uint32_t mitosis_aes_ecb_encrypt_count(void)
+{
+    return encrypt_count;
+}
+
+uint32_t mitosis_aes_ecb_wakeup_count(void)
+{
+    return wakeup_counts;
+}
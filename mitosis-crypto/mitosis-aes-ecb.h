@@ -18,4 +18,46 @@ bool mitosis_aes_ecb_init(mitosis_aes_ecb_context_t* state);
 
 bool mitosis_aes_ecb_encrypt(mitosis_aes_ecb_context_t* state);
 
+/*
+    Encrypts the blocks of several independent contexts in one call.
+    Blocks that depend on each other's output (e.g. CBC/CMAC chaining) can't
+    be batched. Returns false if any block fails.
+*/
+bool mitosis_aes_ecb_encrypt_batch(mitosis_aes_ecb_context_t* const states[], size_t count);
+
+// Number of blocks encrypted so far. Used for diagnostics and benchmarking.
+uint32_t mitosis_aes_ecb_encrypt_count(void);
+
+// Total times thread mode woke up while waiting for blocks that completed.
+uint32_t mitosis_aes_ecb_wakeup_count(void);
+
+/*
+    Asynchronous interface. Requests are queued and the peripheral works
+    through them in order, raising the ECB interrupt after each block. The
+    caller owns the request and must keep it alive until it completes.
+    The callback may run from the ECB interrupt, or from whichever context
+    calls mitosis_aes_ecb_service(); done is set after it returns.
+*/
+struct _mitosis_aes_ecb_request_t;
+typedef void (*mitosis_aes_ecb_callback_t)(struct _mitosis_aes_ecb_request_t* request);
+
+typedef struct _mitosis_aes_ecb_request_t {
+    mitosis_aes_ecb_context_t* state;
+    mitosis_aes_ecb_callback_t callback; // optional
+    void* user;
+    volatile bool done;
+    bool success;
+    struct _mitosis_aes_ecb_request_t* next;
+} mitosis_aes_ecb_request_t;
+
+// Queues request. Fails if the request or its state is NULL.
+bool mitosis_aes_ecb_encrypt_async(mitosis_aes_ecb_request_t* request);
+
+// Completes the request at the head of the queue if its block has finished,
+// and starts the next one. Returns true if a request was completed.
+bool mitosis_aes_ecb_service(void);
+
+// True while any request is queued or in flight.
+bool mitosis_aes_ecb_busy(void);
+
 #endif
@@ -16,70 +16,127 @@ bool mitosis_ckdf_extract(const uint8_t* ikm, size_t ikm_len, const uint8_t* sal
     return mitosis_cmac_compute(&state, ikm, ikm_len, prk);
 }
 
+typedef struct _ckdf_stream_t {
+    mitosis_cmac_context_t cmac;
+    // Bytes of okm already written.
+    uint16_t offset;
+    // Bytes of info already hashed for the current iteration.
+    uint16_t info_offset;
+    // i starts at 1 so it can be hashed directly as the block counter.
+    uint8_t i;
+    // T(i-1) still has to be hashed. Until then it's in cmac.ecb.ciphertext.
+    bool previous_pending;
+    bool last_block;
+} ckdf_stream_t;
+
+// Loads the next block of T(i-1) || info || i into the stream's CMAC context.
+static inline
+bool prepare_block(ckdf_stream_t* stream, const mitosis_ckdf_output_t* output)
+{
+    uint8_t tail[AES_BLOCK_SIZE];
+    size_t remaining = output->info_len - stream->info_offset;
+
+    stream->last_block = false;
+    if (stream->previous_pending)
+    {
+        stream->previous_pending = false;
+        return mitosis_cmac_prepare_block(&stream->cmac, stream->cmac.ecb.ciphertext, AES_BLOCK_SIZE, false);
+    }
+    if (remaining >= AES_BLOCK_SIZE)
+    {
+        stream->info_offset += AES_BLOCK_SIZE;
+        return mitosis_cmac_prepare_block(&stream->cmac, output->info + stream->info_offset - AES_BLOCK_SIZE, AES_BLOCK_SIZE, false);
+    }
+
+    // The last block is whatever is left of info, followed by i.
+    memcpy(tail, output->info + stream->info_offset, remaining);
+    tail[remaining] = stream->i;
+    stream->last_block = true;
+    return mitosis_cmac_prepare_block(&stream->cmac, tail, remaining + 1, true);
+}
+
 bool
 mitosis_ckdf_expand(const uint8_t* prk, size_t prk_len, const uint8_t* info, size_t info_len, uint8_t* okm, size_t okm_len)
 {
     mitosis_cmac_context_t state;
-    uint8_t scratch[AES_BLOCK_SIZE];
-    uint8_t iterations;
-    uint16_t offset = 0;
+    const mitosis_ckdf_output_t output = { info, info_len, okm, okm_len };
 
-    if (okm_len > 255 * AES_BLOCK_SIZE)
+    if (!mitosis_cmac_init(&state, prk, prk_len))
     {
         return false;
     }
+    return mitosis_ckdf_expand_multi(&state, &output, 1);
+}
 
-    if (okm_len % AES_BLOCK_SIZE)
-    {
-        iterations = (uint8_t)(okm_len / AES_BLOCK_SIZE) + 1;
-    }
-    else
+bool
+mitosis_ckdf_expand_multi(const mitosis_cmac_context_t* prk_context, const mitosis_ckdf_output_t outputs[], size_t count)
+{
+    ckdf_stream_t streams[MITOSIS_CKDF_MAX_OUTPUTS];
+    mitosis_aes_ecb_context_t* batch[MITOSIS_CKDF_MAX_OUTPUTS];
+
+    if (count > MITOSIS_CKDF_MAX_OUTPUTS)
     {
-        iterations = (uint8_t)(okm_len / AES_BLOCK_SIZE);
+        return false;
     }
 
-    // i starts at 1 so it can be used to save the memory needed for a separate
-    // block counter.
-    for (uint8_t i = 1; i <= iterations && i > 0; ++i)
+    for (size_t idx = 0; idx < count; ++idx)
     {
-        if (!mitosis_cmac_init(&state, prk, prk_len))
+        if (outputs[idx].okm_len > 255 * AES_BLOCK_SIZE || outputs[idx].info_len > UINT16_MAX)
         {
             return false;
         }
+        // The subkeys only depend on the PRK, so every output and iteration
+        // reuses them.
+        streams[idx].cmac = *prk_context;
+        mitosis_cmac_reset(&streams[idx].cmac);
+        streams[idx].offset = 0;
+        streams[idx].info_offset = 0;
+        streams[idx].i = 1;
+        streams[idx].previous_pending = false;
+    }
 
-        if (i > 1)
+    while (true)
+    {
+        size_t active = 0;
+        for (size_t idx = 0; idx < count; ++idx)
         {
-            if (!mitosis_cmac_hash(&state, scratch, sizeof(scratch)))
+            if (streams[idx].offset < outputs[idx].okm_len)
             {
-                return false;
+                if (!prepare_block(&streams[idx], &outputs[idx]))
+                {
+                    return false;
+                }
+                batch[active++] = &streams[idx].cmac.ecb;
             }
         }
-
-        if (!mitosis_cmac_hash(&state, info, info_len))
+        if (active == 0)
         {
-            return false;
+            return true;
         }
 
-        if (!mitosis_cmac_hash(&state, &i, 1))
+        // The outputs' CMAC chains don't depend on each other, so each round
+        // is a single batch.
+        if (!mitosis_aes_ecb_encrypt_batch(batch, active))
         {
             return false;
         }
 
-        if (!mitosis_cmac_complete(&state, scratch))
+        for (size_t idx = 0; idx < count; ++idx)
         {
-            return false;
-        }
+            ckdf_stream_t* stream = &streams[idx];
+            size_t remaining = outputs[idx].okm_len - stream->offset;
+            if (remaining == 0 || !stream->last_block)
+            {
+                continue;
+            }
 
-        if (okm_len > sizeof(scratch))
-        {
-            memcpy(okm + offset, scratch, sizeof(scratch));
-            okm_len -= sizeof(scratch);
-            offset += sizeof(scratch);
-        }
-        else
-        {
-            memcpy(okm + offset, scratch, okm_len);
+            // T(i) is complete; emit it and start the next iteration.
+            size_t len = (remaining > AES_BLOCK_SIZE) ? AES_BLOCK_SIZE : remaining;
+            memcpy(outputs[idx].okm + stream->offset, stream->cmac.ecb.ciphertext, len);
+            stream->offset += len;
+            stream->info_offset = 0;
+            stream->previous_pending = true;
+            ++stream->i;
         }
     }
-    return true;
 }
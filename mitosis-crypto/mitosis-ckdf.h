@@ -3,8 +3,27 @@ CKDF interface for Mitosis keyboard
 
 Based on draft-agl-ckdf-01 (https://tools.ietf.org/html/draft-agl-ckdf-01)
 */
-
+#include "mitosis-cmac.h"
 
 bool mitosis_ckdf_extract(const uint8_t* ikm, size_t ikm_len, const uint8_t* salt, size_t salt_len, uint8_t* prk);
 
 bool mitosis_ckdf_expand(const uint8_t* prk, size_t prk_len, const uint8_t* info, size_t info_len, uint8_t* okm, size_t okm_len);
+
+// Maximum number of outputs mitosis_ckdf_expand_multi() derives at once.
+#define MITOSIS_CKDF_MAX_OUTPUTS 4
+
+typedef struct _mitosis_ckdf_output_t {
+    const uint8_t* info;
+    size_t info_len;
+    uint8_t* okm;
+    size_t okm_len;
+} mitosis_ckdf_output_t;
+
+/*
+Derives several outputs from one PRK, given a CMAC context already initialized
+with it. Each output is identical to mitosis_ckdf_expand() with its own info
+string, but the CMAC chains are advanced in lockstep so every round is one
+batched ECB call, and the PRK's CMAC subkeys are only derived once.
+okm buffers may alias the PRK, since prk_context holds its own copy of the key.
+*/
+bool mitosis_ckdf_expand_multi(const mitosis_cmac_context_t* prk_context, const mitosis_ckdf_output_t outputs[], size_t count);
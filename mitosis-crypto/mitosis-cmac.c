@@ -96,6 +96,12 @@ bool mitosis_cmac_init(mitosis_cmac_context_t* context, const uint8_t* key, size
     return true;
 }
 
+void mitosis_cmac_reset(mitosis_cmac_context_t* context)
+{
+    context->multiblock = false;
+    context->plaintext_index = 0;
+}
+
 bool mitosis_cmac_hash(mitosis_cmac_context_t* context, const uint8_t* data, size_t data_len)
 {
     do
@@ -194,3 +200,95 @@ bool mitosis_cmac_compute(mitosis_cmac_context_t* context, const uint8_t* data,
 
     return true;
 }
+
+// Loads a message's last block into the ECB plaintext, padded and masked.
+static inline
+void load_last_block(mitosis_cmac_context_t* context, const uint8_t* data, size_t datalen)
+{
+    if (datalen == AES_BLOCK_SIZE)
+    {
+        // A complete block is masked with K1.
+        for (int i = 0; i < AES_BLOCK_SIZE; ++i)
+        {
+            context->ecb.plaintext[i] = data[i] ^ context->key1[i];
+        }
+    }
+    else
+    {
+        // A partial block is padded with 0x80 00.. and masked with K2.
+        // Byte-wise, since packet payloads aren't guaranteed to be aligned.
+        uint32_t i = 0;
+        for (; i < datalen; ++i)
+        {
+            context->ecb.plaintext[i] = data[i] ^ context->key2[i];
+        }
+        context->ecb.plaintext[i] = 0x80 ^ context->key2[i];
+        for (++i; i < AES_BLOCK_SIZE; ++i)
+        {
+            context->ecb.plaintext[i] = context->key2[i];
+        }
+    }
+}
+
+static inline
+bool cmac_block(mitosis_cmac_context_t* context, const uint8_t* data, size_t datalen)
+{
+    if (datalen > AES_BLOCK_SIZE)
+    {
+        return false;
+    }
+
+    load_last_block(context, data, datalen);
+    return mitosis_aes_ecb_encrypt(&context->ecb);
+}
+
+bool mitosis_cmac_prepare_block(mitosis_cmac_context_t* context, const uint8_t* data, size_t datalen, bool last)
+{
+    if (datalen > AES_BLOCK_SIZE || (!last && datalen != AES_BLOCK_SIZE))
+    {
+        return false;
+    }
+
+    if (last)
+    {
+        load_last_block(context, data, datalen);
+    }
+    else
+    {
+        memcpy(context->ecb.plaintext, data, AES_BLOCK_SIZE);
+    }
+
+    // carry forward previous result, if present
+    if (context->multiblock)
+    {
+        xor128(context->ecb.ciphertext, context->ecb.plaintext, context->ecb.plaintext);
+    }
+    context->multiblock = !last;
+    context->plaintext_index = 0;
+    return true;
+}
+
+bool mitosis_cmac_compute_block(mitosis_cmac_context_t* context, const uint8_t* data, size_t datalen, uint8_t* output)
+{
+    if (!cmac_block(context, data, datalen))
+    {
+        return false;
+    }
+    memcpy(output, context->ecb.ciphertext, sizeof(context->ecb.ciphertext));
+    return true;
+}
+
+bool mitosis_cmac_verify_block(mitosis_cmac_context_t* context, const uint8_t* data, size_t datalen, const uint8_t* mac)
+{
+    uint8_t difference = 0;
+
+    if (!cmac_block(context, data, datalen))
+    {
+        return false;
+    }
+    for (int i = 0; i < MITOSIS_CMAC_OUTPUT_SIZE; ++i)
+    {
+        difference |= context->ecb.ciphertext[i] ^ mac[i];
+    }
+    return difference == 0;
+}
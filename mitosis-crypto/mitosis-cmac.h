@@ -2,6 +2,9 @@
     Implementation of CMAC using AES for Mitosis.
 */
 
+#ifndef _MITOSIS_CMAC
+#define _MITOSIS_CMAC
+
 #include "mitosis-aes-ecb.h"
 
 #define MITOSIS_CMAC_OUTPUT_SIZE AES_BLOCK_SIZE
@@ -16,9 +19,39 @@ typedef struct _mitosis_cmac_context_t {
 
 bool mitosis_cmac_init(mitosis_cmac_context_t* context, const uint8_t* key, size_t key_len);
 
+/*
+    Discards any partially hashed data but keeps the key and K1/K2 subkeys, so
+    a context can be reused for another message without repeating
+    mitosis_cmac_init(). A context can also be cloned by plain assignment.
+*/
+void mitosis_cmac_reset(mitosis_cmac_context_t* context);
+
 bool mitosis_cmac_hash(mitosis_cmac_context_t* context, const uint8_t* data, size_t data_len);
 
 bool mitosis_cmac_complete(mitosis_cmac_context_t* context, uint8_t* output);
 
 // If all data is ready in a contiguous buffer, call this.
 bool mitosis_cmac_compute(mitosis_cmac_context_t* context, const uint8_t* data, size_t datalen, uint8_t* output);
+
+/*
+    Fast path for messages of at most one block (datalen <= AES_BLOCK_SIZE),
+    such as packet payloads. Builds the K1/K2-masked block directly and does a
+    single ECB operation, bypassing the streaming state. Don't interleave with
+    an in-progress mitosis_cmac_hash().
+*/
+bool mitosis_cmac_compute_block(mitosis_cmac_context_t* context, const uint8_t* data, size_t datalen, uint8_t* output);
+
+// Same as mitosis_cmac_compute_block(), but compares against an expected MAC in constant time.
+bool mitosis_cmac_verify_block(mitosis_cmac_context_t* context, const uint8_t* data, size_t datalen, const uint8_t* mac);
+
+/*
+    Loads the next block of a message into context->ecb, chained and masked as
+    needed, but leaves encrypting it to the caller, so the ECB operations of
+    several contexts can be batched. Every block but the last must be complete.
+    Encrypt context->ecb before preparing the next block; after the last one,
+    context->ecb.ciphertext is the MAC. Don't interleave with
+    mitosis_cmac_hash().
+*/
+bool mitosis_cmac_prepare_block(mitosis_cmac_context_t* context, const uint8_t* data, size_t datalen, bool last);
+
+#endif
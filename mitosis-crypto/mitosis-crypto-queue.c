@@ -0,0 +1,76 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "mitosis-crypto-queue.h"
+
+#define QUEUE_MASK (MITOSIS_CRYPTO_QUEUE_SIZE - 1)
+
+// Acquire/release ordering makes sure a job's contents are visible before
+// the index that publishes it. On the nRF51 these are plain word accesses
+// plus a barrier; on the host they also hold between threads.
+#define LOAD_INDEX(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define STORE_INDEX(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+
+void mitosis_crypto_queue_init(mitosis_crypto_queue_t* queue)
+{
+    memset(queue, 0, sizeof(*queue));
+}
+
+mitosis_crypto_job_t* mitosis_crypto_queue_reserve(mitosis_crypto_queue_t* queue)
+{
+    uint32_t head = queue->head;
+
+    if (head - LOAD_INDEX(queue->tail) >= MITOSIS_CRYPTO_QUEUE_SIZE)
+    {
+        ++queue->overflows;
+        return NULL;
+    }
+    return &queue->jobs[head & QUEUE_MASK];
+}
+
+void mitosis_crypto_queue_commit(mitosis_crypto_queue_t* queue)
+{
+    uint32_t head = queue->head;
+    uint32_t depth;
+
+    STORE_INDEX(queue->head, head + 1);
+
+    depth = head + 1 - LOAD_INDEX(queue->tail);
+    if (depth > queue->high_water)
+    {
+        queue->high_water = depth;
+    }
+}
+
+mitosis_crypto_job_t* mitosis_crypto_queue_peek(mitosis_crypto_queue_t* queue)
+{
+    uint32_t tail = queue->tail;
+
+    if (LOAD_INDEX(queue->head) == tail)
+    {
+        return NULL;
+    }
+    return &queue->jobs[tail & QUEUE_MASK];
+}
+
+mitosis_crypto_job_t* mitosis_crypto_queue_at(mitosis_crypto_queue_t* queue, uint32_t index)
+{
+    uint32_t tail = queue->tail;
+
+    if (LOAD_INDEX(queue->head) - tail <= index)
+    {
+        return NULL;
+    }
+    return &queue->jobs[(tail + index) & QUEUE_MASK];
+}
+
+void mitosis_crypto_queue_release(mitosis_crypto_queue_t* queue)
+{
+    STORE_INDEX(queue->tail, queue->tail + 1);
+}
+
+uint32_t mitosis_crypto_queue_depth(mitosis_crypto_queue_t* queue)
+{
+    uint32_t tail = LOAD_INDEX(queue->tail);
+    return LOAD_INDEX(queue->head) - tail;
+}
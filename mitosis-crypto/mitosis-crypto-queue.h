@@ -0,0 +1,67 @@
+/*
+    Single-producer/single-consumer queue for handing crypto work from an
+    interrupt handler to the main loop without losing it.
+    The producer only writes head and the consumer only writes tail, so
+    neither side ever needs to disable interrupts. Jobs are filled and read
+    in place to avoid extra copies.
+*/
+
+#ifndef _MITOSIS_CRYPTO_QUEUE
+#define _MITOSIS_CRYPTO_QUEUE
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Must be a power of two.
+#define MITOSIS_CRYPTO_QUEUE_SIZE 8
+// Room for the largest Gazell payload and a timestamp.
+#define MITOSIS_CRYPTO_JOB_DATA_SIZE 36
+
+typedef struct _mitosis_crypto_job_t {
+    // Word aligned, so a received payload can be used in place.
+    union {
+        uint8_t data[MITOSIS_CRYPTO_JOB_DATA_SIZE];
+        uint32_t words[MITOSIS_CRYPTO_JOB_DATA_SIZE / sizeof(uint32_t)];
+    };
+    uint8_t pipe;
+    uint8_t length;
+} mitosis_crypto_job_t;
+
+typedef struct _mitosis_crypto_queue_t {
+    mitosis_crypto_job_t jobs[MITOSIS_CRYPTO_QUEUE_SIZE];
+    // Free-running counters; only the producer writes head, only the
+    // consumer writes tail.
+    uint32_t head;
+    uint32_t tail;
+    // Producer-side statistics.
+    uint32_t high_water;
+    uint32_t overflows;
+} mitosis_crypto_queue_t;
+
+void mitosis_crypto_queue_init(mitosis_crypto_queue_t* queue);
+
+/*
+    Producer side. reserve() returns the next free job to fill in, or NULL
+    (and counts an overflow) if the queue is full. commit() publishes it.
+*/
+mitosis_crypto_job_t* mitosis_crypto_queue_reserve(mitosis_crypto_queue_t* queue);
+void mitosis_crypto_queue_commit(mitosis_crypto_queue_t* queue);
+
+/*
+    Consumer side. peek() returns the oldest job, or NULL if the queue is
+    empty. release() hands its slot back to the producer.
+*/
+mitosis_crypto_job_t* mitosis_crypto_queue_peek(mitosis_crypto_queue_t* queue);
+void mitosis_crypto_queue_release(mitosis_crypto_queue_t* queue);
+
+/*
+    Consumer side. Returns the waiting job index places after the oldest, or
+    NULL if there aren't that many, so the consumer can look ahead before
+    releasing anything.
+*/
+mitosis_crypto_job_t* mitosis_crypto_queue_at(mitosis_crypto_queue_t* queue, uint32_t index);
+
+// Number of jobs waiting. Safe to call from either side.
+uint32_t mitosis_crypto_queue_depth(mitosis_crypto_queue_t* queue);
+
+#endif
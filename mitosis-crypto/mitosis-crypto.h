@@ -47,12 +47,29 @@ typedef struct _mitosis_crypto_context_t {
     mitosis_cmac_context_t cmac;
 } mitosis_crypto_context_t;
 
+/*
+    While its key state stays the same, a keyboard half resends it as a
+    heartbeat: MITOSIS_HEARTBEAT_MIN_MS after the last change, then at
+    doubling intervals up to MITOSIS_HEARTBEAT_MAX_MS. The receiver releases
+    a half's keys once it hasn't heard from it for MITOSIS_INACTIVE_MS, which
+    allows for a few lost heartbeats.
+*/
+#define MITOSIS_HEARTBEAT_MIN_MS 125
+#define MITOSIS_HEARTBEAT_MAX_MS 1000
+#define MITOSIS_INACTIVE_MS (4 * MITOSIS_HEARTBEAT_MAX_MS)
+
+#define MITOSIS_AGE_UNIT_US 16
+
 typedef struct _mitosis_crypto_data_payload_t {
     union {
         struct {
             uint8_t data[5];   // interphase has 5 data bytes compared to the 3 bytes for the mitosis
             uint8_t key_id;
-            uint32_t counter;   // 5 (data) + 1 (id) + 2 (pad) + 4 (counter)
+            // Time from the key change to the report being sent, in units of
+            // MITOSIS_AGE_UNIT_US; 0 for reports that don't carry a change.
+            // This used to be padding, which older receivers ignore.
+            uint16_t age;
+            uint32_t counter;   // 5 (data) + 1 (id) + 2 (age) + 4 (counter)
         };
         uint8_t payload[12];
     };
@@ -74,6 +91,86 @@ typedef struct _mitosis_crypto_seed_payload_t {
 
 _Static_assert(sizeof(mitosis_crypto_seed_payload_t) == 32);
 
+/*
+    Link statistics a keyboard half keeps about itself. They're cumulative
+    since the half last reset, and are sent to the receiver two at a time,
+    one page per telemetry packet; page p carries values 2p and 2p+1.
+*/
+typedef enum _mitosis_telemetry_value_t {
+    mitosis_telemetry_tx_count,
+    mitosis_telemetry_tx_fail,
+    mitosis_telemetry_rtx_count,
+    mitosis_telemetry_max_rtx,
+    mitosis_telemetry_rekey_cmac_success,
+    mitosis_telemetry_rekey_cmac_failure,
+    mitosis_telemetry_rekey_decrypt_failure,
+    mitosis_telemetry_crypto_failure,
+    mitosis_telemetry_report_overflows,
+    mitosis_telemetry_report_high_water,
+    MITOSIS_TELEMETRY_VALUES
+} mitosis_telemetry_value_t;
+
+#define MITOSIS_TELEMETRY_PAGE_VALUES 2
+#define MITOSIS_TELEMETRY_PAGES (MITOSIS_TELEMETRY_VALUES / MITOSIS_TELEMETRY_PAGE_VALUES)
+
+// Encrypted and MAC'd like a data payload, with the same key and counter.
+// The receiver tells the two apart by length.
+typedef struct _mitosis_crypto_telemetry_payload_t {
+    union {
+        struct {
+            uint32_t values[MITOSIS_TELEMETRY_PAGE_VALUES];   // encrypted
+            uint8_t page;
+            uint8_t key_id;
+            uint32_t counter;   // 8 (values) + 1 (page) + 1 (id) + 2 (pad) + 4 (counter)
+        };
+        uint8_t payload[16];
+    };
+    uint8_t mac[16];
+} mitosis_crypto_telemetry_payload_t;
+
+_Static_assert(sizeof(mitosis_crypto_telemetry_payload_t) == 32);
+
+/*
+    Replay protection for one key: the highest counter accepted so far, and
+    a bitmap of which of the 64 counters up to and including it have been
+    seen (bit n for highest - n). Zero it whenever the key changes.
+*/
+#define MITOSIS_REPLAY_WINDOW 64
+
+typedef struct _mitosis_replay_window_t {
+    uint64_t seen;
+    uint32_t highest;
+} mitosis_replay_window_t;
+
+// Returns false if counter has been seen or is too old to tell.
+inline
+bool
+mitosis_replay_check(const mitosis_replay_window_t* window, uint32_t counter)
+{
+    uint32_t age;
+
+    if (counter > window->highest)
+    {
+        return true;
+    }
+    age = window->highest - counter;
+    return age < MITOSIS_REPLAY_WINDOW && !(window->seen & (1ULL << age));
+}
+
+// Marks counter seen. Only call this once the packet has been authenticated.
+inline
+void
+mitosis_replay_update(mitosis_replay_window_t* window, uint32_t counter)
+{
+    if (counter > window->highest)
+    {
+        uint32_t shift = counter - window->highest;
+        window->seen = (shift < MITOSIS_REPLAY_WINDOW) ? window->seen << shift : 0;
+        window->highest = counter;
+    }
+    window->seen |= 1ULL << (window->highest - counter);
+}
+
 typedef enum _mitosis_crypto_key_type_t {
     right_keyboard_crypto_key,
     left_keyboard_crypto_key,
@@ -82,33 +179,43 @@ typedef enum _mitosis_crypto_key_type_t {
 
 
 inline
-bool
-mitosis_crypto_rekey(mitosis_crypto_context_t* context, mitosis_crypto_key_type_t type, const uint8_t* seed, size_t seed_len)
+const uint8_t*
+mitosis_crypto_salt(mitosis_crypto_key_type_t type, size_t* salt_len)
 {
-    bool result = true;
-    uint8_t prk[MITOSIS_CMAC_OUTPUT_SIZE];
     static const uint8_t left_salt[sizeof((uint8_t[]) MITOSIS_LEFT_SALT)] = MITOSIS_LEFT_SALT;
     static const uint8_t right_salt[sizeof((uint8_t[]) MITOSIS_RIGHT_SALT)] = MITOSIS_RIGHT_SALT;
     static const uint8_t receiver_salt[sizeof((uint8_t[]) MITOSIS_RECEIVER_SALT)] = MITOSIS_RECEIVER_SALT;
-    const uint8_t* salt;
-    size_t salt_len;
 
     switch(type)
     {
         case right_keyboard_crypto_key:
-            salt = right_salt;
-            salt_len = sizeof(right_salt);
-            break;
+            *salt_len = sizeof(right_salt);
+            return right_salt;
         case left_keyboard_crypto_key:
-            salt = left_salt;
-            salt_len = sizeof(left_salt);
-            break;
+            *salt_len = sizeof(left_salt);
+            return left_salt;
         case receiver_crypto_key:
-            salt = receiver_salt;
-            salt_len = sizeof(receiver_salt);
-            break;
+            *salt_len = sizeof(receiver_salt);
+            return receiver_salt;
         default:
-            return false;
+            return NULL;
+    }
+}
+
+inline
+bool
+mitosis_crypto_rekey(mitosis_crypto_context_t* context, mitosis_crypto_key_type_t type, const uint8_t* seed, size_t seed_len)
+{
+    bool result = true;
+    uint8_t prk[MITOSIS_CMAC_OUTPUT_SIZE];
+    mitosis_cmac_context_t prk_context;
+    const uint8_t* salt;
+    size_t salt_len;
+
+    salt = mitosis_crypto_salt(type, &salt_len);
+    if (salt == NULL)
+    {
+        return false;
     }
 
     result =
@@ -121,22 +228,29 @@ mitosis_crypto_rekey(mitosis_crypto_context_t* context, mitosis_crypto_key_type_
         return result;
     }
 
-    result =
-        mitosis_ckdf_expand(
-            prk, sizeof(prk),
-            (uint8_t*)MITOSIS_ENCRYPT_KEY_INFO, sizeof(MITOSIS_ENCRYPT_KEY_INFO),
-            context->encrypt.ctr.key, sizeof(context->encrypt.ctr.key));
-    if (!result)
+    // All three outputs are expanded from the same PRK, so derive its CMAC
+    // subkeys once and advance the three expansions together.
+    if (!mitosis_cmac_init(&prk_context, prk, sizeof(prk)))
     {
-        return result;
+        return false;
     }
 
-    result =
-        mitosis_ckdf_expand(
-            prk, sizeof(prk),
-            (uint8_t*)MITOSIS_NONCE_INFO,
-            sizeof(MITOSIS_NONCE_INFO),
-            context->encrypt.ctr.iv_bytes, sizeof(context->encrypt.ctr.iv_bytes));
+    // prk can be overwritten by the MAC key because prk_context holds its own copy.
+    const mitosis_ckdf_output_t outputs[] = {
+        {
+            (uint8_t*)MITOSIS_ENCRYPT_KEY_INFO, sizeof(MITOSIS_ENCRYPT_KEY_INFO),
+            context->encrypt.ctr.key, sizeof(context->encrypt.ctr.key)
+        },
+        {
+            (uint8_t*)MITOSIS_NONCE_INFO, sizeof(MITOSIS_NONCE_INFO),
+            context->encrypt.ctr.iv_bytes, sizeof(context->encrypt.ctr.iv_bytes)
+        },
+        {
+            (uint8_t*)MITOSIS_CMAC_KEY_INFO, sizeof(MITOSIS_CMAC_KEY_INFO),
+            prk, AES_BLOCK_SIZE
+        }
+    };
+    result = mitosis_ckdf_expand_multi(&prk_context, outputs, sizeof(outputs)/sizeof(outputs[0]));
     if (!result)
     {
         return result;
@@ -145,24 +259,159 @@ mitosis_crypto_rekey(mitosis_crypto_context_t* context, mitosis_crypto_key_type_
     // Initialize counter to zero.
     context->encrypt.ctr.iv.counter = 0;
 
-    // prk can be overwritten here because mitosis_ckdf_expand is done with it
-    // by the time that output is being written.
-    result =
-        mitosis_ckdf_expand(
-            prk, sizeof(prk),
-            (uint8_t*)MITOSIS_CMAC_KEY_INFO, sizeof(MITOSIS_CMAC_KEY_INFO),
-            prk, AES_BLOCK_SIZE);
-    if (!result)
+    if (!mitosis_cmac_init(&(context->cmac), prk, sizeof(prk)))
     {
-        return result;
+        return false;
     }
 
-    if (!mitosis_cmac_init(&(context->cmac), prk, sizeof(prk)))
+    return mitosis_aes_ecb_init(&(context->encrypt.ecb));
+}
+
+/*
+    Does the same derivation as mitosis_crypto_rekey(), a step at a time, so
+    the receiver can generate keys between packets. Each call to
+    mitosis_crypto_rekey_step() does at most one ECB operation. The new keys
+    are kept in the job and only copied into the context by the last step, so
+    the context stays usable until then.
+*/
+typedef enum _mitosis_crypto_rekey_step_t {
+    mitosis_rekey_step_salt,
+    mitosis_rekey_step_extract,
+    mitosis_rekey_step_prk,
+    // Each output hashes its info string, then completes the CMAC.
+    mitosis_rekey_step_expand,
+    mitosis_rekey_step_commit = mitosis_rekey_step_expand + 6,
+    mitosis_rekey_step_done
+} mitosis_crypto_rekey_step_t;
+
+typedef struct _mitosis_crypto_rekey_job_t {
+    mitosis_crypto_context_t* context;
+    mitosis_cmac_context_t cmac;
+    uint8_t seed[AES_BLOCK_SIZE];
+    uint8_t key[AES_BLOCK_SIZE];
+    uint8_t iv[AES_BLOCK_SIZE];
+    // The PRK, and later the MAC key; cmac holds its own copy of the PRK.
+    uint8_t prk[AES_BLOCK_SIZE];
+    uint8_t seed_len;
+    uint8_t type;
+    uint8_t step;
+} mitosis_crypto_rekey_job_t;
+
+// The hash step can only flush one block.
+_Static_assert(sizeof(MITOSIS_ENCRYPT_KEY_INFO) + 1 <= 2 * AES_BLOCK_SIZE);
+_Static_assert(sizeof(MITOSIS_NONCE_INFO) + 1 <= 2 * AES_BLOCK_SIZE);
+_Static_assert(sizeof(MITOSIS_CMAC_KEY_INFO) + 1 <= 2 * AES_BLOCK_SIZE);
+
+inline
+bool
+mitosis_crypto_rekey_start(mitosis_crypto_rekey_job_t* job, mitosis_crypto_context_t* context, mitosis_crypto_key_type_t type, const uint8_t* seed, size_t seed_len)
+{
+    if (seed_len > sizeof(job->seed))
     {
         return false;
     }
+    job->context = context;
+    memcpy(job->seed, seed, seed_len);
+    job->seed_len = seed_len;
+    job->type = type;
+    job->step = mitosis_rekey_step_salt;
+    return true;
+}
 
-    return mitosis_aes_ecb_init(&(context->encrypt.ecb));
+inline
+bool
+mitosis_crypto_rekey_finished(const mitosis_crypto_rekey_job_t* job)
+{
+    return job->step == mitosis_rekey_step_done;
+}
+
+inline
+bool
+mitosis_crypto_rekey_step(mitosis_crypto_rekey_job_t* job)
+{
+    static const uint8_t iteration = 1;
+    const uint8_t* salt;
+    size_t salt_len;
+
+    if (job->step < mitosis_rekey_step_expand)
+    {
+        switch (job->step)
+        {
+            case mitosis_rekey_step_salt:
+                salt = mitosis_crypto_salt(job->type, &salt_len);
+                if (salt == NULL || !mitosis_cmac_init(&job->cmac, salt, salt_len))
+                {
+                    return false;
+                }
+                break;
+            case mitosis_rekey_step_extract:
+                if (!mitosis_cmac_compute_block(&job->cmac, job->seed, job->seed_len, job->prk))
+                {
+                    return false;
+                }
+                break;
+            case mitosis_rekey_step_prk:
+                if (!mitosis_cmac_init(&job->cmac, job->prk, sizeof(job->prk)))
+                {
+                    return false;
+                }
+                break;
+        }
+    }
+    else if (job->step < mitosis_rekey_step_commit)
+    {
+        // Every output fits in one CKDF block, so T(1) = CMAC(PRK, info || 1).
+        uint8_t output = (job->step - mitosis_rekey_step_expand) / 2;
+        if ((job->step - mitosis_rekey_step_expand) % 2 == 0)
+        {
+            static const uint8_t* const infos[] = {
+                (const uint8_t*)MITOSIS_ENCRYPT_KEY_INFO,
+                (const uint8_t*)MITOSIS_NONCE_INFO,
+                (const uint8_t*)MITOSIS_CMAC_KEY_INFO
+            };
+            static const uint8_t info_lens[] = {
+                sizeof(MITOSIS_ENCRYPT_KEY_INFO),
+                sizeof(MITOSIS_NONCE_INFO),
+                sizeof(MITOSIS_CMAC_KEY_INFO)
+            };
+            mitosis_cmac_reset(&job->cmac);
+            if (!mitosis_cmac_hash(&job->cmac, infos[output], info_lens[output]) ||
+                !mitosis_cmac_hash(&job->cmac, &iteration, 1))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            uint8_t* okm[] = { job->key, job->iv, job->prk };
+            if (!mitosis_cmac_complete(&job->cmac, okm[output]))
+            {
+                return false;
+            }
+        }
+    }
+    else if (job->step == mitosis_rekey_step_commit)
+    {
+        mitosis_crypto_context_t* context = job->context;
+        if (!mitosis_cmac_init(&context->cmac, job->prk, sizeof(job->prk)))
+        {
+            return false;
+        }
+        memcpy(context->encrypt.ctr.key, job->key, sizeof(context->encrypt.ctr.key));
+        memcpy(context->encrypt.ctr.iv_bytes, job->iv, sizeof(context->encrypt.ctr.iv_bytes));
+        context->encrypt.ctr.iv.counter = 0;
+        if (!mitosis_aes_ecb_init(&context->encrypt.ecb))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        return true;
+    }
+
+    ++job->step;
+    return true;
 }
 
 inline
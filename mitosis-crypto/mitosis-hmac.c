@@ -1,19 +1,52 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include "mitosis-hmac.h"
 #include <stdio.h>
 
 #define INNER_PAD 0x36
 #define OUTER_PAD 0x5c
-#define INNER_PAD_32 (uint32_t)0x36363636
-#define OUTER_PAD_32 (uint32_t)0x5c5c5c5c
 
+static inline
+void save_midstate(const sha256_context_t* context, uint32_t* midstate)
+{
+    memcpy(midstate, context->state, SHA256_STATE_WORDS * sizeof(uint32_t));
+}
+
+static inline
+void load_midstate(sha256_context_t* context, const uint32_t* midstate)
+{
+    memcpy(context->state, midstate, SHA256_STATE_WORDS * sizeof(uint32_t));
+    context->datalen = 0;
+    context->bitlen = SHA256_BLOCK_SIZE * 8;
+}
+
+// Hashes one block of key material XORed with the pad, and saves the resulting state.
+static inline
+void hash_pad(sha256_context_t* context, const uint8_t* key, size_t len, uint8_t pad, uint32_t* midstate)
+{
+    uint8_t block[SHA256_BLOCK_SIZE];
+    uint32_t idx = 0;
+    for (; idx < len; ++idx)
+    {
+        block[idx] = key[idx] ^ pad;
+    }
+    for (; idx < sizeof(block); ++idx)
+    {
+        block[idx] = pad;
+    }
 
+    sha256_init(context);
+    sha256_update(context, block, sizeof(block));
+    save_midstate(context, midstate);
+}
 
 bool
 mitosis_hmac_init(mitosis_hmac_context_t* state, const uint8_t* key, size_t len)
 {
+    uint8_t newKey[MITOSIS_HMAC_OUTPUT_SIZE] = { 0 };
+
     if (state == 0 || key == 0)
     {
         return false;
@@ -21,7 +54,6 @@ mitosis_hmac_init(mitosis_hmac_context_t* state, const uint8_t* key, size_t len)
 
     if (len > SHA256_BLOCK_SIZE)
     {
-        uint8_t newKey[MITOSIS_HMAC_OUTPUT_SIZE] = { 0 };
         sha256_init(&(state->sha256_context));
         sha256_update(&(state->sha256_context), key, len);
         sha256_final(&(state->sha256_context), newKey);
@@ -29,36 +61,12 @@ mitosis_hmac_init(mitosis_hmac_context_t* state, const uint8_t* key, size_t len)
         len = MITOSIS_HMAC_OUTPUT_SIZE;
     }
 
-    // create inner and outer key from key material.
-    uint32_t idx = 0;
-    for (; len - idx > 4; idx += 4)
-    {
-        // This does a "fast" XOR by doing 32-bits at a time.
-        *(uint32_t*)(state->inner_key + idx) = *(uint32_t*)(key + idx) ^ INNER_PAD_32;
-        *(uint32_t*)(state->outer_key + idx) = *(uint32_t*)(key + idx) ^ OUTER_PAD_32;
-    }
-    for (; len - idx > 0; ++idx)
-    {
-        // Fallback to "slow" XOR for the rest of the key material.
-        state->inner_key[idx] = key[idx] ^ INNER_PAD;
-        state->outer_key[idx] = key[idx] ^ OUTER_PAD;
-    }
-    for (; (idx & 0x3) && idx < sizeof(state->inner_key); ++idx)
-    {
-        // "Slow" copy to the next 4-byte boundary.
-        state->inner_key[idx] = INNER_PAD;
-        state->outer_key[idx] = OUTER_PAD;
-    }
-    for (; idx < sizeof(state->inner_key); idx += 4)
-    {
-        // "Fast" copy the rest of the key material.
-        *(uint32_t*)(state->inner_key + idx) = INNER_PAD_32;
-        *(uint32_t*)(state->outer_key + idx) = OUTER_PAD_32;
-    }
+    // Compress the inner and outer key blocks once, and keep only the results.
+    hash_pad(&(state->sha256_context), key, len, OUTER_PAD, state->outer_state);
+    hash_pad(&(state->sha256_context), key, len, INNER_PAD, state->inner_state);
 
-    sha256_init(&(state->sha256_context));
-
-    sha256_update(&(state->sha256_context), state->inner_key, sizeof(state->inner_key));
+    // The context is left ready for the first message.
+    state->need_reset = 0;
 
     return true;
 }
@@ -72,8 +80,7 @@ mitosis_hmac_hash(mitosis_hmac_context_t* state, const uint8_t* data, size_t len
     }
     if (state->need_reset)
     {
-        sha256_init(&(state->sha256_context));
-        sha256_update(&(state->sha256_context), state->inner_key, sizeof(state->inner_key));
+        load_midstate(&(state->sha256_context), state->inner_state);
         state->need_reset = 0;
     }
     return sha256_update(&(state->sha256_context), data, len) == NRF_SUCCESS;
@@ -86,11 +93,15 @@ mitosis_hmac_complete(mitosis_hmac_context_t* state, uint8_t* hash) {
         return false;
     }
     uint8_t first_hash[MITOSIS_HMAC_OUTPUT_SIZE];
+    if (state->need_reset)
+    {
+        // Nothing was hashed since the last message; start from the inner key.
+        load_midstate(&(state->sha256_context), state->inner_state);
+    }
     state->need_reset = 1;
     sha256_final(&(state->sha256_context), first_hash);
     // Re-use the hash object to compute the 2nd hash pass.
-    sha256_init(&(state->sha256_context));
-    sha256_update(&(state->sha256_context), state->outer_key, sizeof(state->outer_key));
+    load_midstate(&(state->sha256_context), state->outer_state);
     sha256_update(&(state->sha256_context), first_hash, sizeof(first_hash));
     return sha256_final(&(state->sha256_context), hash) == NRF_SUCCESS;
 }
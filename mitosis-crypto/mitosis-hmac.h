@@ -6,10 +6,14 @@ Interface for HMAC-SHA256 for Mitosis keyboard
 
 #define MITOSIS_HMAC_OUTPUT_SIZE 32
 
+#define SHA256_STATE_WORDS 8
+
 typedef struct _mitosis_hmac_context_t {
     sha256_context_t sha256_context;
-    uint8_t inner_key[SHA256_BLOCK_SIZE];
-    uint8_t outer_key[SHA256_BLOCK_SIZE];
+    // SHA-256 state after compressing the ipad and opad key blocks, so each
+    // message can resume from there instead of re-hashing the pads.
+    uint32_t inner_state[SHA256_STATE_WORDS];
+    uint32_t outer_state[SHA256_STATE_WORDS];
     uint32_t need_reset : 1;
 } mitosis_hmac_context_t;
 
@@ -7,3 +7,15 @@
 extern bool mitosis_crypto_init(mitosis_crypto_context_t* context, mitosis_crypto_key_type_t type);
 
 extern bool mitosis_crypto_rekey(mitosis_crypto_context_t* context, mitosis_crypto_key_type_t type, const uint8_t* seed, size_t seed_len);
+
+extern const uint8_t* mitosis_crypto_salt(mitosis_crypto_key_type_t type, size_t* salt_len);
+
+extern bool mitosis_crypto_rekey_start(mitosis_crypto_rekey_job_t* job, mitosis_crypto_context_t* context, mitosis_crypto_key_type_t type, const uint8_t* seed, size_t seed_len);
+
+extern bool mitosis_crypto_rekey_finished(const mitosis_crypto_rekey_job_t* job);
+
+extern bool mitosis_crypto_rekey_step(mitosis_crypto_rekey_job_t* job);
+
+extern bool mitosis_replay_check(const mitosis_replay_window_t* window, uint32_t counter);
+
+extern void mitosis_replay_update(mitosis_replay_window_t* window, uint32_t counter);
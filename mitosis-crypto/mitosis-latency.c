@@ -0,0 +1,54 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "mitosis-latency.h"
+
+void mitosis_latency_reset(mitosis_latency_histogram_t* histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+uint8_t mitosis_latency_bucket(uint32_t latency_us)
+{
+    uint8_t bucket = 0;
+    uint32_t limit = MITOSIS_LATENCY_BUCKET_0_US;
+
+    while (bucket < MITOSIS_LATENCY_BUCKETS - 1 && latency_us >= limit)
+    {
+        ++bucket;
+        limit <<= 1;
+    }
+    return bucket;
+}
+
+uint32_t mitosis_latency_bucket_floor(uint8_t bucket)
+{
+    if (bucket == 0)
+    {
+        return 0;
+    }
+    return (uint32_t) MITOSIS_LATENCY_BUCKET_0_US << (bucket - 1);
+}
+
+void mitosis_latency_record(mitosis_latency_histogram_t* histogram, uint32_t latency_us)
+{
+    uint8_t bucket = mitosis_latency_bucket(latency_us);
+
+    ++histogram->count;
+    if (histogram->sum_us + latency_us < histogram->sum_us)
+    {
+        histogram->sum_us = UINT32_MAX;
+    }
+    else
+    {
+        histogram->sum_us += latency_us;
+    }
+    if (latency_us > histogram->max_us)
+    {
+        histogram->max_us = latency_us;
+    }
+    if (histogram->buckets[bucket] != UINT16_MAX)
+    {
+        ++histogram->buckets[bucket];
+    }
+}
@@ -0,0 +1,68 @@
+/*
+    Fixed-bucket latency histograms, for timing the stages a key press goes
+    through on its way to the host. Bucket 0 counts latencies under
+    MITOSIS_LATENCY_BUCKET_0_US, and each bucket after that is twice as wide
+    as the one before, with the last one open ended. Recording is a handful
+    of instructions, so it's cheap enough for interrupt handlers.
+
+    Timestamps come from TIMER0, free-running at 1MHz. Gazell uses TIMER2
+    on the nRF51.
+*/
+
+#ifndef _MITOSIS_LATENCY
+#define _MITOSIS_LATENCY
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MITOSIS_LATENCY_BUCKETS 16
+#define MITOSIS_LATENCY_BUCKET_0_US 32
+
+// The layout is also the wire format; all fields are little endian.
+typedef struct _mitosis_latency_histogram_t {
+    uint32_t count;
+    // Saturates rather than wrapping.
+    uint32_t sum_us;
+    uint32_t max_us;
+    // Bucket counts saturate too; count keeps the true total.
+    uint16_t buckets[MITOSIS_LATENCY_BUCKETS];
+} mitosis_latency_histogram_t;
+
+_Static_assert(sizeof(mitosis_latency_histogram_t) == 44);
+
+void mitosis_latency_reset(mitosis_latency_histogram_t* histogram);
+void mitosis_latency_record(mitosis_latency_histogram_t* histogram, uint32_t latency_us);
+
+// Which bucket a latency falls in, and the smallest latency in a bucket.
+uint8_t mitosis_latency_bucket(uint32_t latency_us);
+uint32_t mitosis_latency_bucket_floor(uint8_t bucket);
+
+#ifndef UNIX
+#include <nrf.h>
+
+static inline
+void mitosis_latency_timer_start(void)
+{
+    NRF_TIMER0->MODE = TIMER_MODE_MODE_Timer;
+    NRF_TIMER0->BITMODE = TIMER_BITMODE_BITMODE_32Bit;
+    // 16MHz / 2^4
+    NRF_TIMER0->PRESCALER = 4;
+    NRF_TIMER0->TASKS_START = 1;
+}
+
+static inline
+void mitosis_latency_timer_stop(void)
+{
+    NRF_TIMER0->TASKS_STOP = 1;
+}
+
+// Microseconds since the timer was first started, not counting time stopped.
+static inline
+uint32_t mitosis_latency_now(void)
+{
+    NRF_TIMER0->TASKS_CAPTURE[0] = 1;
+    return NRF_TIMER0->CC[0];
+}
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "aes-ni.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <wmmintrin.h>
+
+#define AES_NI_TARGET __attribute__((target("aes,sse2")))
+
+bool aes_ni_available(void) {
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return false;
+	}
+	return (ecx & bit_AES) != 0;
+}
+
+static inline AES_NI_TARGET
+__m128i expand_step(__m128i key, __m128i assist) {
+	assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+	return _mm_xor_si128(key, assist);
+}
+
+// The round constant must be an immediate, so this can't be a loop.
+#define EXPAND_ROUND(round_keys, idx, rcon) \
+	round_keys[idx] = expand_step(round_keys[idx - 1], _mm_aeskeygenassist_si128(round_keys[idx - 1], rcon))
+
+AES_NI_TARGET
+void aes_ni_key_setup(const uint8_t key[], uint32_t w[]) {
+	__m128i round_keys[11];
+
+	round_keys[0] = _mm_loadu_si128((const __m128i*) key);
+	EXPAND_ROUND(round_keys, 1, 0x01);
+	EXPAND_ROUND(round_keys, 2, 0x02);
+	EXPAND_ROUND(round_keys, 3, 0x04);
+	EXPAND_ROUND(round_keys, 4, 0x08);
+	EXPAND_ROUND(round_keys, 5, 0x10);
+	EXPAND_ROUND(round_keys, 6, 0x20);
+	EXPAND_ROUND(round_keys, 7, 0x40);
+	EXPAND_ROUND(round_keys, 8, 0x80);
+	EXPAND_ROUND(round_keys, 9, 0x1b);
+	EXPAND_ROUND(round_keys, 10, 0x36);
+
+	for (int idx = 0; idx < 11; ++idx) {
+		_mm_storeu_si128((__m128i*) &w[idx * 4], round_keys[idx]);
+	}
+}
+
+AES_NI_TARGET
+void aes_ni_encrypt(const uint8_t in[], uint8_t out[], const uint32_t w[]) {
+	const __m128i* round_keys = (const __m128i*) w;
+	__m128i block = _mm_loadu_si128((const __m128i*) in);
+
+	block = _mm_xor_si128(block, _mm_loadu_si128(&round_keys[0]));
+	for (int idx = 1; idx < 10; ++idx) {
+		block = _mm_aesenc_si128(block, _mm_loadu_si128(&round_keys[idx]));
+	}
+	block = _mm_aesenclast_si128(block, _mm_loadu_si128(&round_keys[10]));
+
+	_mm_storeu_si128((__m128i*) out, block);
+}
+
+#else
+
+bool aes_ni_available(void) {
+	return false;
+}
+
+void aes_ni_key_setup(const uint8_t key[], uint32_t w[]) {
+}
+
+void aes_ni_encrypt(const uint8_t in[], uint8_t out[], const uint32_t w[]) {
+}
+
+#endif
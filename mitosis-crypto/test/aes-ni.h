@@ -0,0 +1,20 @@
+/*
+    AES-128 using the x86 AES-NI instructions, for the host ECB backend.
+    Round keys are stored as 11 raw 16-byte blocks in the same 44 words a
+    portable AES-128 key schedule occupies.
+*/
+
+#ifndef _AES_NI_H
+#define _AES_NI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Returns true if this CPU supports AES-NI and the code was built for x86.
+bool aes_ni_available(void);
+
+void aes_ni_key_setup(const uint8_t key[], uint32_t w[]);
+
+void aes_ni_encrypt(const uint8_t in[], uint8_t out[], const uint32_t w[]);
+
+#endif
@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "mitosis-aes-ecb.h"
+#include "aes-ni.h"
 
 #include <stdio.h>
 
@@ -748,13 +749,143 @@ void aes_decrypt(const uint8_t in[], uint8_t out[], const uint32_t key[], int ke
 ** MITOSIS AES ECB INTERFACE FUNCTIONS
 *******************/
 
+// The context layout is shared with the NRF_ECB peripheral, so expanded key
+// schedules can't live inside it. Instead, keep a small direct-mapped cache
+// indexed by context address. An entry is only reused if it belongs to the
+// same context and the key bytes haven't changed since it was expanded.
+#define KEY_SCHEDULE_CACHE_SIZE 16
+#define AES_128_SCHEDULE_WORDS 44
+
+typedef struct _key_schedule_cache_entry_t {
+	const mitosis_aes_ecb_context_t* owner;
+	uint8_t key[AES_BLOCK_SIZE];
+	uint32_t schedule[AES_128_SCHEDULE_WORDS];
+} key_schedule_cache_entry_t;
+
+typedef enum _aes_backend_t {
+	aes_backend_unselected,
+	aes_backend_portable,
+	aes_backend_aes_ni
+} aes_backend_t;
+
+static key_schedule_cache_entry_t key_schedule_cache[KEY_SCHEDULE_CACHE_SIZE];
+static aes_backend_t backend = aes_backend_unselected;
+static uint32_t encrypt_count = 0;
+
+// Picks the backend once, on first use. Cached schedules are only valid for
+// the backend that produced them, so this must never change afterwards.
+// Set MITOSIS_AES_PORTABLE in the environment to force the portable code.
+static aes_backend_t select_backend() {
+	if (backend == aes_backend_unselected) {
+		if (getenv("MITOSIS_AES_PORTABLE") == NULL && aes_ni_available()) {
+			backend = aes_backend_aes_ni;
+		} else {
+			backend = aes_backend_portable;
+		}
+	}
+	return backend;
+}
+
+static const uint32_t* get_key_schedule(const mitosis_aes_ecb_context_t* state) {
+	key_schedule_cache_entry_t* entry =
+		&key_schedule_cache[((uintptr_t) state / sizeof(*state)) % KEY_SCHEDULE_CACHE_SIZE];
+
+	if (entry->owner != state || memcmp(entry->key, state->key, sizeof(entry->key)) != 0) {
+		if (select_backend() == aes_backend_aes_ni) {
+			aes_ni_key_setup(state->key, entry->schedule);
+		} else {
+			aes_key_setup(state->key, entry->schedule, 128);
+		}
+		memcpy(entry->key, state->key, sizeof(entry->key));
+		entry->owner = state;
+	}
+	return entry->schedule;
+}
+
 bool mitosis_aes_ecb_init(mitosis_aes_ecb_context_t* state) {
 	return true;
 }
 
 bool mitosis_aes_ecb_encrypt(mitosis_aes_ecb_context_t* state) {
-	uint32_t key_schedule[60];
-	aes_key_setup(state->key, key_schedule, 128);
-	aes_encrypt(state->plaintext, state->ciphertext, key_schedule, 128);
+	const uint32_t* key_schedule = get_key_schedule(state);
+	if (backend == aes_backend_aes_ni) {
+		aes_ni_encrypt(state->plaintext, state->ciphertext, key_schedule);
+	} else {
+		aes_encrypt(state->plaintext, state->ciphertext, key_schedule, 128);
+	}
+	++encrypt_count;
 	return true;
 }
+
+bool mitosis_aes_ecb_encrypt_batch(mitosis_aes_ecb_context_t* const states[], size_t count) {
+	if (states == NULL) {
+		return false;
+	}
+	for (size_t idx = 0; idx < count; ++idx) {
+		if (states[idx] == NULL) {
+			return false;
+		}
+	}
+
+	for (size_t idx = 0; idx < count; ++idx) {
+		mitosis_aes_ecb_encrypt(states[idx]);
+	}
+	return true;
+}
+
+uint32_t mitosis_aes_ecb_encrypt_count(void) {
+	return encrypt_count;
+}
+
+// Blocks complete synchronously here, so nothing ever sleeps.
+uint32_t mitosis_aes_ecb_wakeup_count(void) {
+	return 0;
+}
+
+/******************
+** ASYNCHRONOUS ECB STAND-IN
+*******************/
+
+// Requests queue up just as they do on the nRF51, but nothing completes
+// until mitosis_aes_ecb_service() is called, which plays the part of the
+// ECB interrupt. Tests can then check that callers don't assume a request
+// finishes as soon as it's queued.
+static mitosis_aes_ecb_request_t* queue_head = NULL;
+static mitosis_aes_ecb_request_t* queue_tail = NULL;
+
+bool mitosis_aes_ecb_encrypt_async(mitosis_aes_ecb_request_t* request) {
+	if (request == NULL || request->state == NULL) {
+		return false;
+	}
+	request->done = false;
+	request->success = false;
+	request->next = NULL;
+	if (queue_tail == NULL) {
+		queue_head = request;
+	} else {
+		queue_tail->next = request;
+	}
+	queue_tail = request;
+	return true;
+}
+
+bool mitosis_aes_ecb_service(void) {
+	mitosis_aes_ecb_request_t* completed = queue_head;
+	if (completed == NULL) {
+		return false;
+	}
+	queue_head = completed->next;
+	if (queue_head == NULL) {
+		queue_tail = NULL;
+	}
+	completed->success = mitosis_aes_ecb_encrypt(completed->state);
+	if (completed->callback != NULL) {
+		completed->callback(completed);
+	}
+	completed->done = true;
+	return true;
+}
+
+bool mitosis_aes_ecb_busy(void) {
+	return queue_head != NULL;
+}
@@ -0,0 +1,293 @@
+/*
+    Host-side micro-benchmarks for the mitosis crypto primitives.
+
+    Reports the wall time and number of AES-ECB block operations for each
+    operation on the per-keypress and rekey paths. Output is CSV by default,
+    or JSON with --json, so results can be diffed between commits.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mitosis-crypto.h"
+
+#define DEFAULT_ITERATIONS 20000
+
+typedef bool (*benchmark_fn)(void);
+
+// Untimed setup; returns how many timed operations may run before the next call.
+typedef uint32_t (*benchmark_prepare_fn)(void);
+
+typedef struct _benchmark_t {
+    const char* name;
+    benchmark_fn fn;
+    // Relative cost; the iteration count is divided by this so slow operations
+    // don't dominate the run time.
+    uint32_t cost;
+    benchmark_prepare_fn prepare;
+} benchmark_t;
+
+typedef struct _benchmark_result_t {
+    const char* name;
+    uint32_t iterations;
+    double ns_per_op;
+    double ecb_per_op;
+} benchmark_result_t;
+
+static const uint8_t seed[15] = {
+    0x3c, 0x41, 0x9e, 0x0a, 0x77, 0x25, 0xd1, 0x6b,
+    0x80, 0x12, 0xfe, 0x5a, 0x93, 0xc4, 0x08
+};
+static const uint8_t salt[AES_BLOCK_SIZE] = MITOSIS_LEFT_SALT;
+static uint8_t ckdf_prk[MITOSIS_CMAC_OUTPUT_SIZE];
+static uint8_t hkdf_prk[MITOSIS_HMAC_OUTPUT_SIZE];
+static uint8_t okm[MITOSIS_HMAC_OUTPUT_SIZE];
+static uint8_t mac_scratch[MITOSIS_CMAC_OUTPUT_SIZE];
+static uint8_t data_scratch[sizeof(((mitosis_crypto_data_payload_t*)0)->data)];
+
+static mitosis_crypto_context_t keys;
+static mitosis_crypto_context_t rekey_scratch;
+static mitosis_crypto_data_payload_t payload;
+static mitosis_crypto_data_payload_t sealed;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static mitosis_aes_ecb_context_t ecb_blocks[4];
+static mitosis_aes_ecb_context_t* const ecb_batch[] = { &ecb_blocks[0], &ecb_blocks[1], &ecb_blocks[2], &ecb_blocks[3] };
+
+bool bench_aes_ecb_encrypt() {
+    return mitosis_aes_ecb_encrypt(&ecb_blocks[0]);
+}
+
+bool bench_aes_ecb_encrypt_batch() {
+    return mitosis_aes_ecb_encrypt_batch(ecb_batch, sizeof(ecb_batch)/sizeof(ecb_batch[0]));
+}
+
+bool bench_cmac_compute() {
+    return mitosis_cmac_compute(&keys.cmac, payload.payload, sizeof(payload.payload), mac_scratch);
+}
+
+bool bench_cmac_compute_block() {
+    return mitosis_cmac_compute_block(&keys.cmac, payload.payload, sizeof(payload.payload), mac_scratch);
+}
+
+bool bench_aes_ctr_encrypt() {
+    keys.encrypt.ctr.iv.counter = payload.counter;
+    return mitosis_aes_ctr_encrypt(&keys.encrypt, sizeof(payload.data), payload.data, data_scratch);
+}
+
+// The keyboard fills the keystream ring while idle, so only the XOR is on the
+// keypress path. The ring refill runs untimed in the prepare step.
+static mitosis_aes_ctr_keystream_t keystream;
+
+uint32_t prepare_aes_ctr_precomputed() {
+    keys.encrypt.ctr.iv.counter = payload.counter;
+    mitosis_aes_ctr_keystream_reset(&keystream);
+    while (mitosis_aes_ctr_precompute(&keys.encrypt, &keystream));
+    return keystream.count;
+}
+
+bool bench_aes_ctr_encrypt_precomputed() {
+    bool result = mitosis_aes_ctr_encrypt_keystream(&keys.encrypt, &keystream, sizeof(payload.data), payload.data, data_scratch);
+    ++keys.encrypt.ctr.iv.counter;
+    return result;
+}
+
+bool bench_ckdf_extract() {
+    return mitosis_ckdf_extract(seed, sizeof(seed), salt, sizeof(salt), ckdf_prk);
+}
+
+bool bench_ckdf_expand() {
+    return mitosis_ckdf_expand(
+        ckdf_prk, sizeof(ckdf_prk),
+        (uint8_t*)MITOSIS_ENCRYPT_KEY_INFO, sizeof(MITOSIS_ENCRYPT_KEY_INFO),
+        okm, AES_BLOCK_SIZE);
+}
+
+bool bench_hkdf_extract() {
+    return mitosis_hkdf_extract(seed, sizeof(seed), salt, sizeof(salt), hkdf_prk);
+}
+
+bool bench_hkdf_expand() {
+    return mitosis_hkdf_expand(
+        hkdf_prk, sizeof(hkdf_prk),
+        (uint8_t*)MITOSIS_ENCRYPT_KEY_INFO, sizeof(MITOSIS_ENCRYPT_KEY_INFO),
+        okm, sizeof(okm));
+}
+
+bool bench_crypto_rekey() {
+    return mitosis_crypto_rekey(&rekey_scratch, left_keyboard_crypto_key, seed, sizeof(seed));
+}
+
+// Mirrors send_data() in the keyboard firmware.
+bool bench_payload_seal() {
+    memcpy(sealed.data, payload.data, sizeof(sealed.data));
+    sealed.key_id = payload.key_id;
+    if (!mitosis_aes_ctr_encrypt(&keys.encrypt, sizeof(sealed.data), sealed.data, sealed.data)) {
+        return false;
+    }
+    sealed.counter = keys.encrypt.ctr.iv.counter++;
+    return mitosis_cmac_compute_block(&keys.cmac, sealed.payload, sizeof(sealed.payload), sealed.mac);
+}
+
+// Mirrors process_received_packet() in the receiver firmware.
+bool bench_payload_open() {
+    if (!mitosis_cmac_verify_block(&keys.cmac, sealed.payload, sizeof(sealed.payload), sealed.mac)) {
+        return false;
+    }
+    keys.encrypt.ctr.iv.counter = sealed.counter;
+    return mitosis_aes_ctr_decrypt(&keys.encrypt, sizeof(sealed.data), sealed.data, data_scratch);
+}
+
+static const benchmark_t benchmarks[] = {
+    { "aes_ecb_encrypt", bench_aes_ecb_encrypt, 1 },
+    { "aes_ecb_encrypt_batch4", bench_aes_ecb_encrypt_batch, 4 },
+    { "cmac_compute", bench_cmac_compute, 1 },
+    { "cmac_compute_block", bench_cmac_compute_block, 1 },
+    { "aes_ctr_encrypt", bench_aes_ctr_encrypt, 1 },
+    { "aes_ctr_encrypt_precomputed", bench_aes_ctr_encrypt_precomputed, 1, prepare_aes_ctr_precomputed },
+    { "ckdf_extract", bench_ckdf_extract, 1 },
+    { "ckdf_expand", bench_ckdf_expand, 2 },
+    { "hkdf_extract", bench_hkdf_extract, 2 },
+    { "hkdf_expand", bench_hkdf_expand, 4 },
+    { "crypto_rekey", bench_crypto_rekey, 10 },
+    { "payload_seal", bench_payload_seal, 2 },
+    { "payload_open", bench_payload_open, 2 },
+};
+
+#define BENCHMARK_COUNT (sizeof(benchmarks)/sizeof(benchmarks[0]))
+
+bool run_benchmark(const benchmark_t* benchmark, uint32_t iterations, benchmark_result_t* result) {
+    // Warm up caches and branch predictors before measuring.
+    for (uint32_t i = 0; i < iterations / 10 + 1; ++i) {
+        if ((benchmark->prepare != NULL && benchmark->prepare() == 0) || !benchmark->fn()) {
+            printf("%s: warm-up failed!\n", benchmark->name);
+            return false;
+        }
+    }
+
+    uint64_t elapsed = 0;
+    uint32_t ecb_count = 0;
+    for (uint32_t i = 0; i < iterations; ) {
+        uint32_t batch = iterations - i;
+        if (benchmark->prepare != NULL) {
+            uint32_t prepared = benchmark->prepare();
+            if (prepared == 0) {
+                printf("%s: prepare failed!\n", benchmark->name);
+                return false;
+            }
+            if (prepared < batch) {
+                batch = prepared;
+            }
+        }
+
+        uint32_t ecb_start = mitosis_aes_ecb_encrypt_count();
+        uint64_t start = now_ns();
+        for (uint32_t end = i + batch; i < end; ++i) {
+            if (!benchmark->fn()) {
+                printf("%s: iteration %u failed!\n", benchmark->name, i);
+                return false;
+            }
+        }
+        elapsed += now_ns() - start;
+        ecb_count += mitosis_aes_ecb_encrypt_count() - ecb_start;
+    }
+
+    result->name = benchmark->name;
+    result->iterations = iterations;
+    result->ns_per_op = (double) elapsed / iterations;
+    result->ecb_per_op = (double) ecb_count / iterations;
+    return true;
+}
+
+void print_csv(const benchmark_result_t* results, size_t count) {
+    printf("name,iterations,ns_per_op,ecb_per_op\n");
+    for (size_t idx = 0; idx < count; ++idx) {
+        printf("%s,%u,%.1f,%.2f\n",
+            results[idx].name, results[idx].iterations, results[idx].ns_per_op, results[idx].ecb_per_op);
+    }
+}
+
+void print_json(const benchmark_result_t* results, size_t count) {
+    printf("[\n");
+    for (size_t idx = 0; idx < count; ++idx) {
+        printf("  {\"name\": \"%s\", \"iterations\": %u, \"ns_per_op\": %.1f, \"ecb_per_op\": %.2f}%s\n",
+            results[idx].name, results[idx].iterations, results[idx].ns_per_op, results[idx].ecb_per_op,
+            (idx + 1 < count) ? "," : "");
+    }
+    printf("]\n");
+}
+
+void usage(const char* program) {
+    printf("usage: %s [--csv | --json] [-n iterations] [filter]\n", program);
+}
+
+int main(int argc, char** argv) {
+    bool json = false;
+    uint32_t iterations = DEFAULT_ITERATIONS;
+    const char* filter = NULL;
+    benchmark_result_t results[BENCHMARK_COUNT];
+    size_t result_count = 0;
+
+    for (int idx = 1; idx < argc; ++idx) {
+        if (strcmp(argv[idx], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[idx], "--csv") == 0) {
+            json = false;
+        } else if (strcmp(argv[idx], "-n") == 0 && idx + 1 < argc) {
+            iterations = (uint32_t) strtoul(argv[++idx], NULL, 0);
+        } else if (argv[idx][0] != '-') {
+            filter = argv[idx];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iterations == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!mitosis_crypto_init(&keys, left_keyboard_crypto_key) ||
+        !mitosis_crypto_init(&rekey_scratch, left_keyboard_crypto_key)) {
+        printf("mitosis_crypto_init failed!\n");
+        return 1;
+    }
+    for (size_t idx = 0; idx < sizeof(ecb_blocks)/sizeof(ecb_blocks[0]); ++idx) {
+        memcpy(ecb_blocks[idx].key, salt, sizeof(ecb_blocks[idx].key));
+        ecb_blocks[idx].key[0] ^= (uint8_t) idx;
+        memset(ecb_blocks[idx].plaintext, (int) idx, sizeof(ecb_blocks[idx].plaintext));
+    }
+    memset(&payload, 0, sizeof(payload));
+    memcpy(payload.data, "\x10\x22\x04\x48\x80", sizeof(payload.data));
+    payload.counter = 0x1234;
+    if (!bench_ckdf_extract() || !bench_hkdf_extract() || !bench_payload_seal()) {
+        printf("benchmark setup failed!\n");
+        return 1;
+    }
+
+    for (size_t idx = 0; idx < BENCHMARK_COUNT; ++idx) {
+        const benchmark_t* benchmark = &benchmarks[idx];
+        if (filter != NULL && strstr(benchmark->name, filter) == NULL) {
+            continue;
+        }
+        uint32_t scaled = iterations / benchmark->cost;
+        if (!run_benchmark(benchmark, scaled ? scaled : 1, &results[result_count])) {
+            return 1;
+        }
+        ++result_count;
+    }
+
+    if (json) {
+        print_json(results, result_count);
+    } else {
+        print_csv(results, result_count);
+    }
+    return 0;
+}
@@ -3,7 +3,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
 #include "mitosis-crypto.h"
+#include "mitosis-crypto-queue.h"
+#include "mitosis-latency.h"
 
 typedef struct _hmac_sha256_vector {
     uint8_t key[131];
@@ -566,6 +570,52 @@ bool cmac_reuse_kat() {
 }
 
 
+bool cmac_block_test() {
+    uint8_t key[AES_BLOCK_SIZE] = "single block mac";
+    uint8_t data[AES_BLOCK_SIZE];
+    uint8_t expected[MITOSIS_CMAC_OUTPUT_SIZE];
+    uint8_t output[MITOSIS_CMAC_OUTPUT_SIZE];
+    mitosis_cmac_context_t context;
+
+    for(int idx = 0; idx < sizeof(data); ++idx) {
+        data[idx] = (uint8_t)(0xa5 ^ (idx * 13));
+    }
+    if(!mitosis_cmac_init(&context, key, sizeof(key))) {
+        printf("%s: failed to initialize CMAC\n", __func__);
+        return false;
+    }
+
+    for(size_t len = 0; len <= sizeof(data); ++len) {
+        if(!mitosis_cmac_compute(&context, data, len, expected)) {
+            printf("%s: failed to compute CMAC\n", __func__);
+            return false;
+        }
+        if(!mitosis_cmac_compute_block(&context, data, len, output)) {
+            printf("%s: failed to compute single-block CMAC\n", __func__);
+            return false;
+        }
+        if(!compare_expected(output, expected, sizeof(output), __func__, "single-block CMAC")) {
+            printf("Length %zu\n", len);
+            return false;
+        }
+        if(!mitosis_cmac_verify_block(&context, data, len, expected)) {
+            printf("%s: valid MAC rejected for length %zu\n", __func__, len);
+            return false;
+        }
+        expected[len % sizeof(expected)] ^= 0x01;
+        if(mitosis_cmac_verify_block(&context, data, len, expected)) {
+            printf("%s: invalid MAC accepted for length %zu\n", __func__, len);
+            return false;
+        }
+    }
+
+    if(mitosis_cmac_compute_block(&context, data, sizeof(data) + 1, output)) {
+        printf("%s: oversized message accepted\n", __func__);
+        return false;
+    }
+    return true;
+}
+
 bool ckdf_extract_kat() {
 
     ckdf_aes128_extract_test_vector test_cases[] =
@@ -722,6 +772,51 @@ error:
     return result;
 }
 
+bool ckdf_expand_multi_test() {
+    uint8_t prk[AES_BLOCK_SIZE] = "multi output prk";
+    const char* infos[] = { MITOSIS_ENCRYPT_KEY_INFO, MITOSIS_NONCE_INFO, "a much longer info string spanning blocks", "" };
+    const size_t lengths[] = { AES_BLOCK_SIZE, AES_BLOCK_SIZE, 3 * AES_BLOCK_SIZE + 7, 1 };
+    uint8_t expected[4][3 * AES_BLOCK_SIZE + 7];
+    uint8_t okm[4][3 * AES_BLOCK_SIZE + 7];
+    mitosis_ckdf_output_t outputs[4];
+    mitosis_cmac_context_t prk_context;
+
+    for(int idx = 0; idx < 4; ++idx) {
+        outputs[idx].info = (const uint8_t*)infos[idx];
+        outputs[idx].info_len = strlen(infos[idx]) + (idx < 3 ? 1 : 0);
+        outputs[idx].okm = okm[idx];
+        outputs[idx].okm_len = lengths[idx];
+        if(!mitosis_ckdf_expand(prk, sizeof(prk), outputs[idx].info, outputs[idx].info_len, expected[idx], lengths[idx])) {
+            printf("%s: mitosis_ckdf_expand failed!\n", __func__);
+            return false;
+        }
+    }
+
+    if(!mitosis_cmac_init(&prk_context, prk, sizeof(prk))) {
+        printf("%s: failed to initialize CMAC\n", __func__);
+        return false;
+    }
+    if(!mitosis_ckdf_expand_multi(&prk_context, outputs, 4)) {
+        printf("%s: mitosis_ckdf_expand_multi failed!\n", __func__);
+        return false;
+    }
+    for(int idx = 0; idx < 4; ++idx) {
+        if(!compare_expected(okm[idx], expected[idx], lengths[idx], __func__, "OKM")) {
+            printf("Output %d\n", idx);
+            return false;
+        }
+    }
+
+    // Output may alias the PRK, as it does during rekey.
+    outputs[0].okm = prk;
+    if(!mitosis_ckdf_expand_multi(&prk_context, outputs, 2) ||
+        !compare_expected(prk, expected[0], AES_BLOCK_SIZE, __func__, "aliased OKM") ||
+        !compare_expected(okm[1], expected[1], AES_BLOCK_SIZE, __func__, "OKM after alias")) {
+        return false;
+    }
+    return true;
+}
+
 bool hkdf_kat() {
     hkdf_sha256_test_vector test_cases[] = {
         {
@@ -989,6 +1084,373 @@ bool aes_ctr_kat() {
     return result;
 }
 
+bool aes_ctr_keystream_test() {
+    uint8_t key[AES_BLOCK_SIZE] = "keystream ring!";
+    uint8_t nonce[AES_BLOCK_SIZE] = "precomputed ctr";
+    uint8_t expected[AES_BLOCK_SIZE];
+    uint8_t output[AES_BLOCK_SIZE];
+    uint8_t plaintext[AES_BLOCK_SIZE] = { 0 };
+    mitosis_encrypt_context_t reference;
+    mitosis_encrypt_context_t context;
+    mitosis_aes_ctr_keystream_t keystream = { 0 };
+
+    if(!mitosis_aes_ctr_init(key, nonce, &reference) || !mitosis_aes_ctr_init(key, nonce, &context)) {
+        printf("%s: mitosis_aes_ctr_init failed!\n", __func__);
+        return false;
+    }
+
+    // Drain the ring at different rates than it's filled, including jumps
+    // in the counter, and compare against a context that never precomputes.
+    for(uint32_t step = 0; step < 4 * MITOSIS_CTR_KEYSTREAM_BLOCKS; ++step) {
+        for(uint32_t fill = 0; fill < step % 3; ++fill) {
+            mitosis_aes_ctr_precompute(&context, &keystream);
+        }
+        if(step == 2 * MITOSIS_CTR_KEYSTREAM_BLOCKS) {
+            reference.ctr.iv.counter += 7;
+            context.ctr.iv.counter += 7;
+        }
+        if(!mitosis_aes_ctr_encrypt(&reference, sizeof(expected), plaintext, expected) ||
+            !mitosis_aes_ctr_encrypt_keystream(&context, &keystream, sizeof(output), plaintext, output)) {
+            printf("%s: mitosis_aes_ctr_encrypt failed!\n", __func__);
+            return false;
+        }
+        if(!compare_expected(output, expected, sizeof(output), __func__, "keystream")) {
+            return false;
+        }
+        ++reference.ctr.iv.counter;
+        ++context.ctr.iv.counter;
+    }
+
+    // A full ring must not be used after the key changes.
+    while(mitosis_aes_ctr_precompute(&context, &keystream));
+    if(keystream.count != MITOSIS_CTR_KEYSTREAM_BLOCKS) {
+        printf("%s: keystream ring not filled!\n", __func__);
+        return false;
+    }
+    key[0] ^= 0xff;
+    memcpy(reference.ctr.key, key, sizeof(key));
+    memcpy(context.ctr.key, key, sizeof(key));
+    mitosis_aes_ctr_keystream_reset(&keystream);
+    if(!mitosis_aes_ctr_encrypt(&reference, sizeof(expected), plaintext, expected) ||
+        !mitosis_aes_ctr_encrypt_keystream(&context, &keystream, sizeof(output), plaintext, output)) {
+        printf("%s: mitosis_aes_ctr_encrypt after reset failed!\n", __func__);
+        return false;
+    }
+    return compare_expected(output, expected, sizeof(output), __func__, "keystream after reset");
+}
+
+bool aes_ecb_batch_test() {
+    mitosis_aes_ecb_context_t batch[18];
+    mitosis_aes_ecb_context_t single;
+    mitosis_aes_ecb_context_t* states[sizeof(batch)/sizeof(batch[0])];
+
+    for(int idx = 0; idx < sizeof(batch)/sizeof(batch[0]); ++idx) {
+        for(int byte = 0; byte < AES_BLOCK_SIZE; ++byte) {
+            batch[idx].key[byte] = (uint8_t)(idx * 31 + byte);
+            batch[idx].plaintext[byte] = (uint8_t)(idx * 17 ^ byte);
+        }
+        // Interleave distant contexts so neighbouring entries are likely to
+        // share key schedule cache slots in the host backend.
+        states[idx] = &batch[(idx & 1) ? (idx / 2) + 9 : idx / 2];
+    }
+
+    if(!mitosis_aes_ecb_encrypt_batch(states, sizeof(states)/sizeof(states[0]))) {
+        printf("%s: mitosis_aes_ecb_encrypt_batch failed!\n", __func__);
+        return false;
+    }
+
+    for(int idx = 0; idx < sizeof(batch)/sizeof(batch[0]); ++idx) {
+        memcpy(single.key, batch[idx].key, sizeof(single.key));
+        memcpy(single.plaintext, batch[idx].plaintext, sizeof(single.plaintext));
+        if(!mitosis_aes_ecb_encrypt(&single)) {
+            printf("%s: mitosis_aes_ecb_encrypt failed!\n", __func__);
+            return false;
+        }
+        if(!compare_expected(batch[idx].ciphertext, single.ciphertext, sizeof(single.ciphertext), __func__, "batched ciphertext")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void aes_ecb_async_callback(mitosis_aes_ecb_request_t* request) {
+    int* completions = (int*) request->user;
+    // The callback runs before done is set, so the request can't look finished yet.
+    *completions = request->done ? -1 : *completions + 1;
+}
+
+bool aes_ecb_async_test() {
+    mitosis_aes_ecb_context_t contexts[3];
+    mitosis_aes_ecb_context_t single;
+    mitosis_aes_ecb_request_t requests[3];
+    mitosis_aes_ecb_request_t bad_request = { .state = NULL };
+    int completions = 0;
+
+    if(mitosis_aes_ecb_encrypt_async(&bad_request) || mitosis_aes_ecb_encrypt_async(NULL)) {
+        printf("%s: mitosis_aes_ecb_encrypt_async accepted a NULL request!\n", __func__);
+        return false;
+    }
+
+    for(int idx = 0; idx < 3; ++idx) {
+        for(int byte = 0; byte < AES_BLOCK_SIZE; ++byte) {
+            contexts[idx].key[byte] = (uint8_t)(idx * 7 + byte);
+            contexts[idx].plaintext[byte] = (uint8_t)(idx * 13 ^ byte);
+        }
+        memset(contexts[idx].ciphertext, 0, sizeof(contexts[idx].ciphertext));
+        requests[idx].state = &contexts[idx];
+        // Leave the last one without a callback; it must still complete.
+        requests[idx].callback = idx < 2 ? aes_ecb_async_callback : NULL;
+        requests[idx].user = &completions;
+        if(!mitosis_aes_ecb_encrypt_async(&requests[idx])) {
+            printf("%s: mitosis_aes_ecb_encrypt_async %d failed!\n", __func__, idx);
+            return false;
+        }
+    }
+
+    // Nothing may complete until the "interrupt" is serviced, and then only
+    // in the order the requests were queued.
+    for(int idx = 0; idx < 3; ++idx) {
+        if(!mitosis_aes_ecb_busy() || requests[idx].done) {
+            printf("%s: request %d completed before being serviced!\n", __func__, idx);
+            return false;
+        }
+        if(!mitosis_aes_ecb_service()) {
+            printf("%s: mitosis_aes_ecb_service %d failed!\n", __func__, idx);
+            return false;
+        }
+        if(!requests[idx].done || !requests[idx].success ||
+            (idx + 1 < 3 && requests[idx + 1].done)) {
+            printf("%s: request %d completed out of order!\n", __func__, idx);
+            return false;
+        }
+    }
+    if(mitosis_aes_ecb_busy() || mitosis_aes_ecb_service()) {
+        printf("%s: queue not empty after all requests completed!\n", __func__);
+        return false;
+    }
+    if(completions != 2) {
+        printf("%s: expected 2 callbacks, got %d!\n", __func__, completions);
+        return false;
+    }
+
+    for(int idx = 0; idx < 3; ++idx) {
+        memcpy(single.key, contexts[idx].key, sizeof(single.key));
+        memcpy(single.plaintext, contexts[idx].plaintext, sizeof(single.plaintext));
+        if(!mitosis_aes_ecb_encrypt(&single)) {
+            printf("%s: mitosis_aes_ecb_encrypt failed!\n", __func__);
+            return false;
+        }
+        if(!compare_expected(contexts[idx].ciphertext, single.ciphertext, sizeof(single.ciphertext), __func__, "async ciphertext")) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#define CRYPTO_QUEUE_HAMMER_JOBS 200000
+
+static mitosis_crypto_queue_t hammer_queue;
+
+static void fill_job_data(mitosis_crypto_job_t* job, uint32_t value) {
+    job->length = (uint8_t)(value % MITOSIS_CRYPTO_JOB_DATA_SIZE) + 1;
+    job->pipe = (uint8_t)(value & 1);
+    for(int idx = 0; idx < job->length; ++idx) {
+        job->data[idx] = (uint8_t)(value + idx);
+    }
+}
+
+static bool check_job_data(const mitosis_crypto_job_t* job, uint32_t value) {
+    if(job->length != (uint8_t)(value % MITOSIS_CRYPTO_JOB_DATA_SIZE) + 1 || job->pipe != (uint8_t)(value & 1)) {
+        return false;
+    }
+    for(int idx = 0; idx < job->length; ++idx) {
+        if(job->data[idx] != (uint8_t)(value + idx)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Plays the part of an interrupt handler queueing work as fast as it can.
+// A full queue is retried rather than dropped, so every job must arrive.
+static void* crypto_queue_producer(void* arg) {
+    for(uint32_t value = 0; value < CRYPTO_QUEUE_HAMMER_JOBS; ++value) {
+        mitosis_crypto_job_t* job;
+        while((job = mitosis_crypto_queue_reserve(&hammer_queue)) == NULL) {
+            sched_yield();
+        }
+        fill_job_data(job, value);
+        mitosis_crypto_queue_commit(&hammer_queue);
+    }
+    return NULL;
+}
+
+bool crypto_queue_test() {
+    mitosis_crypto_queue_t queue;
+    mitosis_crypto_job_t* job;
+    pthread_t producer;
+    uint32_t expected = 0;
+
+    // Single context: fill it, overflow it, drain it.
+    mitosis_crypto_queue_init(&queue);
+    for(uint32_t value = 0; value < MITOSIS_CRYPTO_QUEUE_SIZE; ++value) {
+        job = mitosis_crypto_queue_reserve(&queue);
+        if(job == NULL) {
+            printf("%s: queue full after %u jobs!\n", __func__, value);
+            return false;
+        }
+        fill_job_data(job, value);
+        mitosis_crypto_queue_commit(&queue);
+    }
+    if(mitosis_crypto_queue_reserve(&queue) != NULL || queue.overflows != 1 ||
+        queue.high_water != MITOSIS_CRYPTO_QUEUE_SIZE || mitosis_crypto_queue_depth(&queue) != MITOSIS_CRYPTO_QUEUE_SIZE) {
+        printf("%s: full queue not reported correctly!\n", __func__);
+        return false;
+    }
+    for(uint32_t value = 0; value < MITOSIS_CRYPTO_QUEUE_SIZE; ++value) {
+        job = mitosis_crypto_queue_at(&queue, value);
+        if(job == NULL || !check_job_data(job, value)) {
+            printf("%s: job %u not found by index!\n", __func__, value);
+            return false;
+        }
+    }
+    if(mitosis_crypto_queue_at(&queue, MITOSIS_CRYPTO_QUEUE_SIZE) != NULL) {
+        printf("%s: index past the newest job returned a job!\n", __func__);
+        return false;
+    }
+    for(uint32_t value = 0; value < MITOSIS_CRYPTO_QUEUE_SIZE; ++value) {
+        job = mitosis_crypto_queue_peek(&queue);
+        if(job == NULL || !check_job_data(job, value)) {
+            printf("%s: job %u corrupted or out of order!\n", __func__, value);
+            return false;
+        }
+        mitosis_crypto_queue_release(&queue);
+    }
+    if(mitosis_crypto_queue_peek(&queue) != NULL || mitosis_crypto_queue_at(&queue, 0) != NULL ||
+        mitosis_crypto_queue_depth(&queue) != 0) {
+        printf("%s: queue not empty after draining!\n", __func__);
+        return false;
+    }
+
+    // Producer and consumer running concurrently.
+    mitosis_crypto_queue_init(&hammer_queue);
+    if(pthread_create(&producer, NULL, crypto_queue_producer, NULL) != 0) {
+        printf("%s: pthread_create failed!\n", __func__);
+        return false;
+    }
+    while(expected < CRYPTO_QUEUE_HAMMER_JOBS) {
+        job = mitosis_crypto_queue_peek(&hammer_queue);
+        if(job == NULL) {
+            sched_yield();
+            continue;
+        }
+        if(!check_job_data(job, expected)) {
+            printf("%s: job %u corrupted or out of order!\n", __func__, expected);
+            pthread_join(producer, NULL);
+            return false;
+        }
+        mitosis_crypto_queue_release(&hammer_queue);
+        ++expected;
+    }
+    pthread_join(producer, NULL);
+    if(mitosis_crypto_queue_depth(&hammer_queue) != 0 || hammer_queue.high_water > MITOSIS_CRYPTO_QUEUE_SIZE) {
+        printf("%s: bad final state: depth %u, high water %u!\n", __func__,
+            mitosis_crypto_queue_depth(&hammer_queue), hammer_queue.high_water);
+        return false;
+    }
+    return true;
+}
+
+bool latency_histogram_test() {
+    mitosis_latency_histogram_t histogram;
+    static const struct {
+        uint32_t latency_us;
+        uint8_t bucket;
+    } cases[] = {
+        { 0, 0 },
+        { MITOSIS_LATENCY_BUCKET_0_US - 1, 0 },
+        { MITOSIS_LATENCY_BUCKET_0_US, 1 },
+        { 2 * MITOSIS_LATENCY_BUCKET_0_US - 1, 1 },
+        { 2 * MITOSIS_LATENCY_BUCKET_0_US, 2 },
+        { 5000, 8 },
+        { UINT32_MAX, MITOSIS_LATENCY_BUCKETS - 1 },
+    };
+
+    for(size_t idx = 0; idx < sizeof(cases) / sizeof(cases[0]); ++idx) {
+        uint8_t bucket = mitosis_latency_bucket(cases[idx].latency_us);
+        if(bucket != cases[idx].bucket) {
+            printf("%s: %u us in bucket %u, expected %u!\n", __func__, cases[idx].latency_us, bucket, cases[idx].bucket);
+            return false;
+        }
+        if(mitosis_latency_bucket(mitosis_latency_bucket_floor(bucket)) != bucket) {
+            printf("%s: floor of bucket %u is outside it!\n", __func__, bucket);
+            return false;
+        }
+    }
+
+    mitosis_latency_reset(&histogram);
+    mitosis_latency_record(&histogram, 10);
+    mitosis_latency_record(&histogram, 5000);
+    mitosis_latency_record(&histogram, 40);
+    if(histogram.count != 3 || histogram.sum_us != 5050 || histogram.max_us != 5000 ||
+        histogram.buckets[0] != 1 || histogram.buckets[1] != 1 || histogram.buckets[8] != 1) {
+        printf("%s: histogram totals wrong!\n", __func__);
+        return false;
+    }
+
+    // Sums and buckets saturate instead of wrapping.
+    mitosis_latency_record(&histogram, UINT32_MAX);
+    histogram.buckets[0] = UINT16_MAX;
+    mitosis_latency_record(&histogram, 0);
+    if(histogram.sum_us != UINT32_MAX || histogram.max_us != UINT32_MAX ||
+        histogram.buckets[0] != UINT16_MAX || histogram.count != 5) {
+        printf("%s: histogram didn't saturate!\n", __func__);
+        return false;
+    }
+    return true;
+}
+
+bool replay_window_test() {
+    mitosis_replay_window_t window = { 0 };
+    static const struct {
+        uint32_t counter;
+        bool fresh;
+    } cases[] = {
+        { 0, true },
+        { 0, false },
+        { 3, true },
+        { 1, true },
+        { 3, false },
+        { 1, false },
+        { 2, true },
+        { 66, true },
+        { 4, true },        // still in the window
+        { 67, true },
+        { 5, true },
+        { 66, false },
+        { 1000, true },
+        { 900, false },     // never seen, but too old to tell
+        { 999, true },
+        { 1000, false },
+    };
+
+    for(size_t idx = 0; idx < sizeof(cases) / sizeof(cases[0]); ++idx) {
+        if(mitosis_replay_check(&window, cases[idx].counter) != cases[idx].fresh) {
+            printf("%s: counter %u %s accepted!\n", __func__, cases[idx].counter,
+                cases[idx].fresh ? "wasn't" : "was");
+            return false;
+        }
+        if(cases[idx].fresh) {
+            mitosis_replay_update(&window, cases[idx].counter);
+        }
+    }
+    if(window.highest != 1000) {
+        printf("%s: highest counter is %u, expected 1000!\n", __func__, window.highest);
+        return false;
+    }
+    return true;
+}
+
 bool verify_key_generation() {
     mitosis_crypto_context_t context;
     bool result = true;
@@ -1018,6 +1480,79 @@ bool verify_key_generation() {
     return result;
 }
 
+bool rekey_job_test() {
+    const uint8_t seed[15] = {
+        0x3c, 0x51, 0x9e, 0x07, 0xa2, 0x6b, 0xf0, 0x18, 0xd5, 0x44, 0x8f, 0x2a, 0xc9, 0x73, 0x0e };
+    mitosis_crypto_context_t expected;
+    mitosis_crypto_context_t actual;
+    mitosis_crypto_rekey_job_t job;
+    int steps = 0;
+
+    for(int type = right_keyboard_crypto_key; type <= receiver_crypto_key; ++type) {
+        char* label = (type == right_keyboard_crypto_key) ? "right" : (type == left_keyboard_crypto_key) ? "left" : "receiver";
+
+        if(!mitosis_crypto_rekey(&expected, type, seed, sizeof(seed))) {
+            printf("%s: %s mitosis_crypto_rekey failed!\n", __func__, label);
+            return false;
+        }
+        // The context must keep its old keys until the last step.
+        if(!mitosis_crypto_init(&actual, type)) {
+            printf("%s: %s mitosis_crypto_init failed!\n", __func__, label);
+            return false;
+        }
+        mitosis_crypto_context_t old = actual;
+
+        if(!mitosis_crypto_rekey_start(&job, &actual, type, seed, sizeof(seed))) {
+            printf("%s: %s mitosis_crypto_rekey_start failed!\n", __func__, label);
+            return false;
+        }
+        for(steps = 0; !mitosis_crypto_rekey_finished(&job); ++steps) {
+            if(memcmp(&actual, &old, sizeof(actual)) != 0) {
+                printf("%s: %s context changed before the last step!\n", __func__, label);
+                return false;
+            }
+            uint32_t start = mitosis_aes_ecb_encrypt_count();
+            if(!mitosis_crypto_rekey_step(&job)) {
+                printf("%s: %s mitosis_crypto_rekey_step %d failed!\n", __func__, label, steps);
+                return false;
+            }
+            if(mitosis_aes_ecb_encrypt_count() - start > 1) {
+                printf("%s: %s step %d did %u ECB operations!\n", __func__, label, steps,
+                    mitosis_aes_ecb_encrypt_count() - start);
+                return false;
+            }
+        }
+
+        if(!compare_expected(actual.encrypt.ctr.key, expected.encrypt.ctr.key, sizeof(actual.encrypt.ctr.key), __func__, "key") ||
+            !compare_expected(actual.encrypt.ctr.iv_bytes, expected.encrypt.ctr.iv_bytes, sizeof(actual.encrypt.ctr.iv_bytes), __func__, "nonce") ||
+            !compare_expected(actual.cmac.key1, expected.cmac.key1, sizeof(actual.cmac.key1), __func__, "cmac key 1") ||
+            !compare_expected(actual.cmac.key2, expected.cmac.key2, sizeof(actual.cmac.key2), __func__, "cmac key 2") ||
+            !compare_expected(actual.cmac.ecb.key, expected.cmac.ecb.key, sizeof(actual.cmac.ecb.key), __func__, "cmac key")) {
+            printf("%s: %s stepped rekey doesn't match!\n", __func__, label);
+            return false;
+        }
+        if(actual.encrypt.ctr.iv.counter != 0) {
+            printf("%s: %s counter wasn't reset!\n", __func__, label);
+            return false;
+        }
+    }
+
+    // Further steps do nothing.
+    uint32_t start = mitosis_aes_ecb_encrypt_count();
+    if(!mitosis_crypto_rekey_step(&job) || mitosis_aes_ecb_encrypt_count() != start) {
+        printf("%s: stepping a finished job did work!\n", __func__);
+        return false;
+    }
+
+    uint8_t long_seed[AES_BLOCK_SIZE + 1] = { 0 };
+    if(mitosis_crypto_rekey_start(&job, &actual, left_keyboard_crypto_key, long_seed, sizeof(long_seed))) {
+        printf("%s: mitosis_crypto_rekey_start accepted a seed longer than a block!\n", __func__);
+        return false;
+    }
+
+    return true;
+}
+
 bool verify_key_encryption_decryption_test() {
     bool result = true;
     uint8_t data[] = {'a', 'b', 'c'};
@@ -1128,11 +1663,20 @@ int main(int argc, char** argv) {
     RUN_TEST_LOG(hmac_sha256_kat);
     RUN_TEST_LOG(cmac_kat);
     RUN_TEST_LOG(cmac_reuse_kat);
+    RUN_TEST_LOG(cmac_block_test);
     RUN_TEST_LOG(ckdf_extract_kat);
     RUN_TEST_LOG(ckdf_expand_kat);
+    RUN_TEST_LOG(ckdf_expand_multi_test);
     RUN_TEST_LOG(hkdf_kat);
     RUN_TEST_LOG(aes_ctr_kat);
+    RUN_TEST_LOG(aes_ctr_keystream_test);
+    RUN_TEST_LOG(aes_ecb_batch_test);
+    RUN_TEST_LOG(aes_ecb_async_test);
+    RUN_TEST_LOG(crypto_queue_test);
+    RUN_TEST_LOG(latency_histogram_test);
     RUN_TEST_LOG(verify_key_generation);
+    RUN_TEST_LOG(rekey_job_test);
+    RUN_TEST_LOG(replay_window_test);
     RUN_TEST_LOG(verify_key_encryption_decryption_test);
     RUN_TEST_LOG(end_to_end_test);
 
@@ -1141,5 +1685,5 @@ int main(int argc, char** argv) {
     } else {
         printf("%d failures! :(\n", failures);
     }
-    return 0;
+    return result ? 0 : 1;
 }
@@ -1,6 +1,8 @@
 
+#if !defined(COMPILE_LEFT) && !defined(COMPILE_RIGHT)
 //#define COMPILE_RIGHT
 #define COMPILE_LEFT
+#endif
 
 #include "interphase.h"
 #include "nrf_drv_config.h"
@@ -9,8 +11,11 @@
 #include "nrf_delay.h"
 #include "nrf_drv_clock.h"
 #include "nrf_drv_rtc.h"
+#include "app_util_platform.h"
 #include <string.h>
 #include "mitosis-crypto.h"
+#include "mitosis-crypto-queue.h"
+#include "mitosis-latency.h"
 
 
 /*****************************************************************************/
@@ -26,44 +31,156 @@ const nrf_drv_rtc_t rtc_deb = NRF_DRV_RTC_INSTANCE(1); /**< Declaring an instanc
 
 // Data and acknowledgement payloads
 static mitosis_crypto_data_payload_t data_payload;  ///< Payload to send to Host.
+static mitosis_crypto_telemetry_payload_t telemetry_payload;  ///< Link statistics for the Host.
 static mitosis_crypto_seed_payload_t ack_payload;   ///< Payloads received in ACKs from Host.
 
-// Crypto state
-static mitosis_crypto_context_t crypto;
+// A seed from the receiver waiting for the main loop. The radio callback only
+// fills it in while seed_pending is clear; the receiver keeps sending the
+// seed until it's used, so any that arrive in the meantime can be dropped.
+static mitosis_crypto_seed_payload_t seed_payload;
+static volatile bool seed_pending = false;
+// MAC of the last seed applied, to recognise the receiver resending it.
+static uint8_t applied_seed_mac[MITOSIS_CMAC_OUTPUT_SIZE];
+
+// Crypto state. Reports are sealed with the context crypto points to. New
+// keys are derived into the other one by the main loop, which only then
+// switches crypto over to it.
+static mitosis_crypto_context_t crypto_contexts[2];
+static mitosis_crypto_context_t* volatile crypto = &crypto_contexts[0];
 static mitosis_crypto_context_t receiver_crypto;
-static volatile bool encrypting = false;
-
-// Debounce time (dependent on tick frequency)
+static mitosis_aes_ctr_keystream_t keystream; ///< CTR keystream for crypto, computed while idle.
+
+// Key states waiting to be encrypted and sent. Both RTC handlers and the
+// GPIOTE handler queue reports; they run at the same priority so they never
+// preempt each other, and together form the single producer. The main loop
+// is the consumer.
+static mitosis_crypto_queue_t report_queue;
+
+// A queued report, held in the job's data.
+typedef struct _report_t {
+    // For reports carrying a key change: when the change was first seen,
+    // and when it finished debouncing.
+    uint32_t changed;
+    uint32_t debounced;
+    uint8_t keys[ROWS];
+    bool fresh;
+    // Send the next page of link statistics instead of key states.
+    bool telemetry;
+} report_t;
+
+_Static_assert(sizeof(report_t) <= MITOSIS_CRYPTO_JOB_DATA_SIZE);
+
+// Debounce time (dependent on tick frequency): a key has to read differently
+// from its debounced state for this many ticks in a row to change.
 #define DEBOUNCE 5
-#define ACTIVITY 500
+// With eager presses, a press is reported on its first edge and only
+// releases wait out DEBOUNCE.
+#ifndef DEBOUNCE_EAGER_PRESS
+#define DEBOUNCE_EAGER_PRESS 1
+#endif
+// Keypress latency timestamps come from TIMER0, which keeps the high frequency
+// clock running whenever the keyboard is awake, so they cost battery and are
+// off unless asked for. Without them every timestamp is 0, and reports that
+// carry a change give the smallest age.
+#ifndef MITOSIS_LATENCY
+#define MITOSIS_LATENCY 0
+#endif
+#if MITOSIS_LATENCY
+#define LATENCY_TIMER_START() mitosis_latency_timer_start()
+#define LATENCY_TIMER_STOP() mitosis_latency_timer_stop()
+#define LATENCY_NOW() mitosis_latency_now()
+#define LATENCY_RECORD(histogram, latency) mitosis_latency_record(&(histogram), (latency))
+#else
+#define LATENCY_TIMER_START()
+#define LATENCY_TIMER_STOP()
+#define LATENCY_NOW() 0
+#define LATENCY_RECORD(histogram, latency) ((void) (histogram))
+#endif
+// Idle maintenance ticks before going to sleep
+#define ACTIVITY 4
+// Idle maintenance ticks between telemetry packets
+#define TELEMETRY_TICKS 4
+// Maintenance ticks between heartbeats, right after a change and at most
+#define HEARTBEAT_MIN_TICKS (MITOSIS_HEARTBEAT_MIN_MS * RTC0_CONFIG_FREQUENCY / 1000)
+#define HEARTBEAT_MAX_TICKS (MITOSIS_HEARTBEAT_MAX_MS * RTC0_CONFIG_FREQUENCY / 1000)
+_Static_assert(HEARTBEAT_MIN_TICKS >= 1 && HEARTBEAT_MIN_TICKS <= HEARTBEAT_MAX_TICKS);
+
+// The matrix is only scanned at the full tick rate in bursts, started by a
+// GPIOTE edge and ended after this many ticks with no key changing.
+#define QUIET_TICKS 10
+// Between bursts, while keys are held, the matrix is scanned once every this
+// many ticks. GPIOTE can't see a press in a column that already has a key
+// held, or a release that leaves another key held in its column.
+#define HELD_SCAN_TICKS 8
 
 // Key buffers
-static uint8_t keys[ROWS], keys_snapshot[ROWS], keys_buffer[ROWS];
-static uint32_t debounce_ticks, activity_ticks;
-static volatile bool debouncing = false;
+static uint8_t keys[ROWS], keys_buffer[ROWS];
+static uint32_t activity_ticks;
+static bool scanning = true;
+static uint32_t quiet_ticks;
+
+// Per-key debounce counters, kept bit-parallel: bit c of debounce_count[k][r]
+// is bit k of the count for the key at row r, column c, so a whole row is
+// debounced with a few logic operations.
+#define DEBOUNCE_COUNT_BITS 3
+_Static_assert(DEBOUNCE >= 1 && DEBOUNCE <= (1 << DEBOUNCE_COUNT_BITS));
+static uint8_t debounce_count[DEBOUNCE_COUNT_BITS][ROWS];
+// When each key's pending change was first seen.
+static uint32_t key_changed[ROWS][8];
+
+// Pipeline latency in microseconds: each key's change to debounced,
+// debounced to handed to Gazell, and handed to Gazell to ACKed.
+static mitosis_latency_histogram_t debounce_latency;
+static mitosis_latency_histogram_t queue_latency;
+static mitosis_latency_histogram_t radio_latency;
+static uint32_t change_started;
+static volatile bool asleep = false;
+
+// When each packet in the Gazell TX FIFO was added. Only the main loop
+// writes tx_added and only the radio callbacks write tx_done.
+#define TX_TIMES 4
+static uint32_t tx_times[TX_TIMES];
+static volatile uint32_t tx_added = 0;
+static volatile uint32_t tx_done = 0;
 
 // Debug helper variables
 static uint16_t max_rtx = 0;
 static uint32_t rtx_count = 0;
 static uint32_t tx_count = 0;
 static uint32_t tx_fail = 0;
-static volatile uint32_t encrypt_collisions = 0;
 static volatile uint32_t encrypt_failure = 0;
 static volatile uint32_t cmac_failure = 0;
 static volatile uint32_t rekey_cmac_success = 0;
 static volatile uint32_t rekey_cmac_failure = 0;
 static volatile uint32_t rekey_decrypt_failure = 0;
+static uint8_t telemetry_page = 0;
+static uint8_t telemetry_ticks = 0;
+static uint8_t heartbeat_interval = HEARTBEAT_MIN_TICKS;
+static uint8_t heartbeat_ticks = 0;
+
+// How a column pin senses: not at all while scanning, otherwise for the
+// edge away from its debounced state. held has a bit per column, laid out
+// like a row from read_row().
+#define COLUMN_SENSE(watch, held, bit) \
+    (!(watch) ? NRF_GPIO_PIN_NOSENSE : \
+    (((held) >> (bit)) & 1) ? NRF_GPIO_PIN_SENSE_LOW : NRF_GPIO_PIN_SENSE_HIGH)
+
+// Configure the column inputs with pulldowns
+static void sense_columns(bool watch, uint8_t held)
+{
+    nrf_gpio_cfg_sense_input(C01, NRF_GPIO_PIN_PULLDOWN, COLUMN_SENSE(watch, held, 7));
+    nrf_gpio_cfg_sense_input(C02, NRF_GPIO_PIN_PULLDOWN, COLUMN_SENSE(watch, held, 6));
+    nrf_gpio_cfg_sense_input(C03, NRF_GPIO_PIN_PULLDOWN, COLUMN_SENSE(watch, held, 5));
+    nrf_gpio_cfg_sense_input(C04, NRF_GPIO_PIN_PULLDOWN, COLUMN_SENSE(watch, held, 4));
+    nrf_gpio_cfg_sense_input(C05, NRF_GPIO_PIN_PULLDOWN, COLUMN_SENSE(watch, held, 3));
+    nrf_gpio_cfg_sense_input(C06, NRF_GPIO_PIN_PULLDOWN, COLUMN_SENSE(watch, held, 2));
+    nrf_gpio_cfg_sense_input(C07, NRF_GPIO_PIN_PULLDOWN, COLUMN_SENSE(watch, held, 1));
+}
 
-// Setup switch pins with pullups
+// Setup switch pins
 static void gpio_config(void)
 {
-    nrf_gpio_cfg_sense_input(C01, NRF_GPIO_PIN_PULLDOWN, NRF_GPIO_PIN_SENSE_HIGH);
-    nrf_gpio_cfg_sense_input(C02, NRF_GPIO_PIN_PULLDOWN, NRF_GPIO_PIN_SENSE_HIGH);
-    nrf_gpio_cfg_sense_input(C03, NRF_GPIO_PIN_PULLDOWN, NRF_GPIO_PIN_SENSE_HIGH);
-    nrf_gpio_cfg_sense_input(C04, NRF_GPIO_PIN_PULLDOWN, NRF_GPIO_PIN_SENSE_HIGH);
-    nrf_gpio_cfg_sense_input(C05, NRF_GPIO_PIN_PULLDOWN, NRF_GPIO_PIN_SENSE_HIGH);
-    nrf_gpio_cfg_sense_input(C06, NRF_GPIO_PIN_PULLDOWN, NRF_GPIO_PIN_SENSE_HIGH);
-    nrf_gpio_cfg_sense_input(C07, NRF_GPIO_PIN_PULLDOWN, NRF_GPIO_PIN_SENSE_HIGH);
+    sense_columns(false, 0);
 
     nrf_gpio_cfg_output(R01);
     nrf_gpio_cfg_output(R02);
@@ -102,11 +219,11 @@ static void read_keys(void)
     return;
 }
 
-static bool compare_keys(uint8_t* first, uint8_t* second, uint32_t size)
+static bool empty_keys(void)
 {
-    for(int i=0; i < size; i++)
+    for(int i=0; i < ROWS; i++)
     {
-        if (first[i] != second[i])
+        if (keys_buffer[i])
         {
           return false;
         }
@@ -114,141 +231,396 @@ static bool compare_keys(uint8_t* first, uint8_t* second, uint32_t size)
     return true;
 }
 
-static bool empty_keys(void)
+// Queue the current key states to be encrypted and sent by the main loop.
+// fresh is set when they're the result of a key change.
+static void send_data(bool fresh)
 {
-    for(int i=0; i < ROWS; i++)
+    mitosis_crypto_job_t* job = mitosis_crypto_queue_reserve(&report_queue);
+
+    // A full queue is counted in report_queue.overflows; the next report
+    // carries the complete key state anyway.
+    if (job != NULL)
     {
-        if (keys_buffer[i])
-        {
-          return false;
-        }
+        report_t* report = (report_t*) job->data;
+        memcpy(report->keys, keys, ROWS);
+        report->telemetry = false;
+        report->fresh = fresh;
+        report->changed = change_started;
+        report->debounced = LATENCY_NOW();
+        job->length = sizeof(*report);
+        mitosis_crypto_queue_commit(&report_queue);
     }
-    return true;
 }
 
-// Assemble packet and send to receiver
-static void send_data(void)
+// Queue a request for the main loop to send the next page of link statistics.
+static void send_telemetry(void)
 {
-    // If an encryption operation is already in-progress, skip reading the keys
-    // and just return.
-    // This could cause missing keypresses so consider queueing the work to be
-    // done once the crypto operation is done.
-    if (!encrypting)
-    {
-        encrypting = true;
-        uint8_t* data = data_payload.data;
-        
-        for(int i=0; i < ROWS; i++)
-        {
-            data[i] = keys[i];
-        }
+    mitosis_crypto_job_t* job = mitosis_crypto_queue_reserve(&report_queue);
 
+    if (job != NULL)
+    {
+        report_t* report = (report_t*) job->data;
+        report->telemetry = true;
+        job->length = sizeof(*report);
+        mitosis_crypto_queue_commit(&report_queue);
+    }
+}
 
-        if (mitosis_aes_ctr_encrypt(&crypto.encrypt, sizeof(data_payload.data), data_payload.data, data_payload.data))
+// Hand a sealed packet to Gazell.
+static void add_to_tx_fifo(const void* packet, uint32_t length)
+{
+    tx_times[tx_added % TX_TIMES] = LATENCY_NOW();
+    if (nrf_gzll_add_packet_to_tx_fifo(PIPE_NUMBER, (uint8_t*) packet, length))
+    {
+        // Gazell only reports on the packet a timeslot later, long
+        // after this is counted.
+        ++tx_added;
+        ++tx_count;
+    }
+    else
+    {
+        ++tx_fail;
+    }
+}
+
+// Assemble a telemetry packet from the next page of statistics and send it.
+// It takes a counter value just like a report, so it uses up the next
+// precomputed keystream block rather than skipping it.
+static void encrypt_and_send_telemetry(void)
+{
+    uint32_t values[MITOSIS_TELEMETRY_VALUES];
+
+    values[mitosis_telemetry_tx_count] = tx_count;
+    values[mitosis_telemetry_tx_fail] = tx_fail;
+    values[mitosis_telemetry_rtx_count] = rtx_count;
+    values[mitosis_telemetry_max_rtx] = max_rtx;
+    values[mitosis_telemetry_rekey_cmac_success] = rekey_cmac_success;
+    values[mitosis_telemetry_rekey_cmac_failure] = rekey_cmac_failure;
+    values[mitosis_telemetry_rekey_decrypt_failure] = rekey_decrypt_failure;
+    values[mitosis_telemetry_crypto_failure] = encrypt_failure + cmac_failure;
+    values[mitosis_telemetry_report_overflows] = report_queue.overflows;
+    values[mitosis_telemetry_report_high_water] = report_queue.high_water;
+
+    telemetry_payload.page = telemetry_page;
+    telemetry_payload.key_id = data_payload.key_id;
+    telemetry_page = (telemetry_page + 1) % MITOSIS_TELEMETRY_PAGES;
+
+    if (mitosis_aes_ctr_encrypt_keystream(
+            &crypto->encrypt,
+            &keystream,
+            sizeof(telemetry_payload.values),
+            (const uint8_t*) &values[telemetry_payload.page * MITOSIS_TELEMETRY_PAGE_VALUES],
+            (uint8_t*) telemetry_payload.values))
+    {
+        telemetry_payload.counter = crypto->encrypt.ctr.iv.counter++;
+        if (mitosis_cmac_compute_block(&crypto->cmac, telemetry_payload.payload, sizeof(telemetry_payload.payload), telemetry_payload.mac))
         {
-            // Copy the used counter and increment at the same time.
-            data_payload.counter = crypto.encrypt.ctr.iv.counter++;
-            // compute cmac on data and counter.
-            if (mitosis_cmac_compute(&crypto.cmac, data_payload.payload, sizeof(data_payload.payload), data_payload.mac))
-            {
-                if (nrf_gzll_add_packet_to_tx_fifo(PIPE_NUMBER, (uint8_t*) &data_payload, TX_PAYLOAD_LENGTH))
-                {
-                    ++tx_count;
-                }
-                else
-                {
-                    ++tx_fail;
-                }
-            }
-            else
-            {
-                ++cmac_failure;
-            }
+            add_to_tx_fifo(&telemetry_payload, sizeof(telemetry_payload));
         }
         else
         {
-            ++encrypt_failure;
+            ++cmac_failure;
         }
-        encrypting = false;
     }
     else
     {
-        ++encrypt_collisions;
+        ++encrypt_failure;
     }
 }
 
-// 8Hz held key maintenance, keeping the reciever keystates valid
-static void handler_maintenance(nrf_drv_rtc_int_type_t int_type)
+// Assemble packet from a queued report and send to receiver
+static void encrypt_and_send(const mitosis_crypto_job_t* job)
 {
-    send_data();
-}
+    const report_t* report = (const report_t*) job->data;
 
-// 1000Hz debounce sampling
-static void handler_debounce(nrf_drv_rtc_int_type_t int_type)
-{
-    read_keys();
+    if (report->telemetry)
+    {
+        encrypt_and_send_telemetry();
+        return;
+    }
+
+    memcpy(data_payload.data, report->keys, sizeof(data_payload.data));
+    data_payload.age = 0;
+    if (report->fresh)
+    {
+        uint32_t now = LATENCY_NOW();
+        uint32_t age = (now - report->changed) / MITOSIS_AGE_UNIT_US;
 
-    // debouncing, waits until there have been no transitions in 5ms (assuming five 1ms ticks)
-    if (debouncing)
+        LATENCY_RECORD(queue_latency, now - report->debounced);
+        data_payload.age = (age == 0) ? 1 : (age > UINT16_MAX) ? UINT16_MAX : age;
+    }
+
+    if (mitosis_aes_ctr_encrypt_keystream(&crypto->encrypt, &keystream, sizeof(data_payload.data), data_payload.data, data_payload.data))
     {
-        // if debouncing, check if current keystates equal to the snapshot
-        if (compare_keys(keys_snapshot, keys_buffer, ROWS))
+        // Copy the used counter and increment at the same time.
+        data_payload.counter = crypto->encrypt.ctr.iv.counter++;
+        // compute cmac on data and counter.
+        if (mitosis_cmac_compute_block(&crypto->cmac, data_payload.payload, sizeof(data_payload.payload), data_payload.mac))
         {
-            // DEBOUNCE ticks of stable sampling needed before sending data
-            debounce_ticks++;
-            if (debounce_ticks == DEBOUNCE)
-            {
-                for(int j=0; j < ROWS; j++)
-                {
-                    keys[j] = keys_snapshot[j];
-                }
-                send_data();
-            }
+            add_to_tx_fifo(&data_payload, TX_PAYLOAD_LENGTH);
         }
         else
         {
-            // if keys change, start period again
-            debouncing = false;
+            ++cmac_failure;
         }
     }
     else
     {
-        // if the keystate is different from the last data
-        // sent to the receiver, start debouncing
-        if (!compare_keys(keys, keys_buffer, ROWS))
+        ++encrypt_failure;
+    }
+}
+
+// Check a seed from the receiver and derive the keys it gives into the spare
+// context, then start sealing reports with them. This takes a chain of ECB
+// operations, so it's done here rather than in the radio callback.
+static void rekey_from_seed(void)
+{
+    uint8_t seed[sizeof(seed_payload.seed)];
+    mitosis_crypto_context_t* next = (crypto == &crypto_contexts[0]) ? &crypto_contexts[1] : &crypto_contexts[0];
+
+    if (!mitosis_cmac_verify_block(&receiver_crypto.cmac, seed_payload.payload, sizeof(seed_payload.payload), seed_payload.mac))
+    {
+        ++rekey_cmac_failure;
+        return;
+    }
+
+    // The receiver keeps sending a seed until it sees it used, so skip the
+    // one already applied. The key id alone can't tell: a receiver that
+    // restarted hands out a fresh seed for the key id already in use.
+    if (memcmp(seed_payload.mac, applied_seed_mac, sizeof(applied_seed_mac)) == 0)
+    {
+        return;
+    }
+    ++rekey_cmac_success;
+
+    receiver_crypto.encrypt.ctr.iv.counter = seed_payload.key_id;
+    if (!mitosis_aes_ctr_decrypt(&receiver_crypto.encrypt, sizeof(seed_payload.seed), seed_payload.seed, seed))
+    {
+        ++rekey_decrypt_failure;
+        return;
+    }
+
+    // The seed packet validates! update the encryption keys.
+#ifdef COMPILE_LEFT
+    if (!mitosis_crypto_rekey(next, left_keyboard_crypto_key, seed, sizeof(seed)))
+#elif defined(COMPILE_RIGHT)
+    if (!mitosis_crypto_rekey(next, right_keyboard_crypto_key, seed, sizeof(seed)))
+#endif
+    {
+        // The current keys are untouched, so carry on with them.
+        ++encrypt_failure;
+        return;
+    }
+    mitosis_aes_ctr_keystream_reset(&keystream);
+    crypto = next;
+    data_payload.key_id = seed_payload.key_id;
+    memcpy(applied_seed_mac, seed_payload.mac, sizeof(applied_seed_mac));
+}
+
+// 8Hz held key maintenance, keeping the reciever keystates valid. The key
+// state is resent less and less often for as long as it doesn't change.
+static void handler_maintenance(nrf_drv_rtc_int_type_t int_type)
+{
+    if (++heartbeat_ticks >= heartbeat_interval)
+    {
+        heartbeat_ticks = 0;
+        heartbeat_interval = (heartbeat_interval * 2 > HEARTBEAT_MAX_TICKS) ?
+            HEARTBEAT_MAX_TICKS : heartbeat_interval * 2;
+        send_data(false);
+    }
+
+    if (!empty_keys())
+    {
+        activity_ticks = 0;
+        return;
+    }
+
+    // While nothing is held, follow up with a page of link statistics every
+    // few ticks.
+    if (++telemetry_ticks >= TELEMETRY_TICKS)
+    {
+        telemetry_ticks = 0;
+        send_telemetry();
+    }
+
+    // Looking for a few ticks of no keys pressed, to go back to deep sleep.
+    // The rows are already driven for the GPIOTE wake-up.
+    if (!scanning && ++activity_ticks > ACTIVITY)
+    {
+        nrf_drv_rtc_disable(&rtc_maint);
+        // The timer keeps the high frequency clock running.
+        LATENCY_TIMER_STOP();
+        asleep = true;
+    }
+}
+
+// Bit-parallel test for keys whose count has reached DEBOUNCE - 1, i.e. this
+// is their DEBOUNCE'th differing sample.
+#define DEBOUNCE_COUNT_IS(k) ((((DEBOUNCE - 1) >> (k)) & 1) ? 0xFF : 0x00)
+
+static inline
+uint8_t debounce_row(int row, uint32_t now, uint32_t* oldest_age)
+{
+    uint8_t* count0 = &debounce_count[0][row];
+    uint8_t* count1 = &debounce_count[1][row];
+    uint8_t* count2 = &debounce_count[2][row];
+    // Keys that read differently from their debounced state. Any other key
+    // starts counting from zero again.
+    uint8_t delta = keys_buffer[row] ^ keys[row];
+    uint8_t started;
+    uint8_t done;
+
+    *count0 &= delta;
+    *count1 &= delta;
+    *count2 &= delta;
+    started = delta & ~(*count0 | *count1 | *count2);
+    done = delta &
+        ~(*count0 ^ DEBOUNCE_COUNT_IS(0)) &
+        ~(*count1 ^ DEBOUNCE_COUNT_IS(1)) &
+        ~(*count2 ^ DEBOUNCE_COUNT_IS(2));
+#if DEBOUNCE_EAGER_PRESS
+    done |= delta & keys_buffer[row];
+#endif
+
+    // Count up, and stop counting keys that are done.
+    *count2 = (*count2 ^ (*count1 & *count0)) & delta & ~done;
+    *count1 = (*count1 ^ *count0) & delta & ~done;
+    *count0 = ~*count0 & delta & ~done;
+
+    for (int column = 0; (started | done) >> column; column++)
+    {
+        if ((started >> column) & 1)
         {
-            for(int k=0; k < ROWS; k++)
+            key_changed[row][column] = now;
+        }
+        if ((done >> column) & 1)
+        {
+            uint32_t age = now - key_changed[row][column];
+            LATENCY_RECORD(debounce_latency, age);
+            if (age > *oldest_age)
             {
-                keys_snapshot[k] = keys_buffer[k];
+                *oldest_age = age;
             }
-            debouncing = true;
-            debounce_ticks = 0;
         }
     }
 
-    // looking for 500 ticks of no keys pressed, to go back to deep sleep
-    if (empty_keys())
+    keys[row] ^= done;
+    return done;
+}
+
+// Sample the matrix and debounce it. Returns true while any key is changing.
+static bool scan_keys(void)
+{
+    uint32_t now = LATENCY_NOW();
+    uint32_t oldest_age = 0;
+    uint8_t changed = 0;
+    uint8_t pending = 0;
+
+    read_keys();
+
+    for (int row = 0; row < ROWS; row++)
     {
-        activity_ticks++;
-        if (activity_ticks > ACTIVITY)
-        {
-            nrf_drv_rtc_disable(&rtc_maint);
-            nrf_drv_rtc_disable(&rtc_deb);
-            nrf_gpio_pin_set(R01);
-            nrf_gpio_pin_set(R02);
-            nrf_gpio_pin_set(R03);
-            nrf_gpio_pin_set(R04);
-            nrf_gpio_pin_set(R05);
-        }
+        changed |= debounce_row(row, now, &oldest_age);
+        pending |= debounce_count[0][row] | debounce_count[1][row] | debounce_count[2][row];
+    }
 
+    if (changed)
+    {
+        // The report's age runs from the oldest change it carries.
+        change_started = now - oldest_age;
+        send_data(true);
+        heartbeat_interval = HEARTBEAT_MIN_TICKS;
+        heartbeat_ticks = 0;
     }
-    else
+    return changed || pending;
+}
+
+static uint8_t held_columns(void)
+{
+    uint8_t held = 0;
+
+    for (int row = 0; row < ROWS; row++)
     {
-        activity_ticks = 0;
+        held |= keys[row];
     }
+    return held;
+}
+
+// Drive every row high and let the columns raise a GPIOTE PORT event for
+// anything that differs from the debounced keys. A held key draws current
+// through its column's pulldown for as long as this lasts.
+static void watch_keys(void)
+{
+    nrf_gpio_pin_set(R01);
+    nrf_gpio_pin_set(R02);
+    nrf_gpio_pin_set(R03);
+    nrf_gpio_pin_set(R04);
+    nrf_gpio_pin_set(R05);
+    sense_columns(true, held_columns());
+}
 
+// Stop watching so the rows can be scanned one at a time.
+static void unwatch_keys(void)
+{
+    sense_columns(false, 0);
+    nrf_gpio_pin_clear(R01);
+    nrf_gpio_pin_clear(R02);
+    nrf_gpio_pin_clear(R03);
+    nrf_gpio_pin_clear(R04);
+    nrf_gpio_pin_clear(R05);
+}
+
+// Scan on every tick from now on.
+static void start_scan_burst(void)
+{
+    scanning = true;
+    quiet_ticks = 0;
+    nrf_drv_rtc_cc_disable(&rtc_deb, 0);
+    nrf_drv_rtc_tick_enable(&rtc_deb, true);
+    nrf_drv_rtc_enable(&rtc_deb);
+}
+
+// Go back to waiting for an edge, with a slow scan if any key is held.
+static void end_scan_burst(void)
+{
+    scanning = false;
+    nrf_drv_rtc_tick_disable(&rtc_deb);
+    if (held_columns())
+    {
+        nrf_drv_rtc_cc_set(&rtc_deb, 0, nrf_drv_rtc_counter_get(&rtc_deb) + HELD_SCAN_TICKS, true);
+    }
+    else
+    {
+        nrf_drv_rtc_disable(&rtc_deb);
+    }
+    watch_keys();
 }
 
+// 1000Hz debounce sampling during a burst, and the held key scan between
+// bursts
+static void handler_debounce(nrf_drv_rtc_int_type_t int_type)
+{
+    if (int_type == NRF_DRV_RTC_INT_COMPARE0)
+    {
+        unwatch_keys();
+        if (scan_keys())
+        {
+            start_scan_burst();
+        }
+        else
+        {
+            end_scan_burst();
+        }
+    }
+    else if (scan_keys())
+    {
+        quiet_ticks = 0;
+    }
+    else if (++quiet_ticks >= QUIET_TICKS)
+    {
+        end_scan_burst();
+    }
+}
 
 // Low frequency clock configuration
 static void lfclk_config(void)
@@ -292,32 +664,60 @@ int main()
     // Configure 32kHz xtal oscillator
     lfclk_config();
 
+    // Timestamps for the latency histograms
+    LATENCY_TIMER_START();
+
     // Configure RTC peripherals with ticks
     rtc_config();
 
     // Configure all keys as inputs with pullups
     gpio_config();
 
-    // Set the GPIOTE PORT event as interrupt source, and enable interrupts for GPIOTE
+    // Set the GPIOTE PORT event as interrupt source, and enable interrupts for GPIOTE.
+    // Its handler scans straight away, so it runs at the same priority as the
+    // debounce RTC.
     NRF_GPIOTE->INTENSET = GPIOTE_INTENSET_PORT_Msk;
+    NVIC_SetPriority(GPIOTE_IRQn, RTC1_CONFIG_IRQ_PRIORITY);
     NVIC_EnableIRQ(GPIOTE_IRQn);
 
 #ifdef COMPILE_LEFT
-    mitosis_crypto_init(&crypto, left_keyboard_crypto_key);
+    mitosis_crypto_init(crypto, left_keyboard_crypto_key);
 #elif defined(COMPILE_RIGHT)
-    mitosis_crypto_init(&crypto, right_keyboard_crypto_key);
+    mitosis_crypto_init(crypto, right_keyboard_crypto_key);
 #else
     #error "no keyboard half specified"
 #endif
     mitosis_crypto_init(&receiver_crypto, receiver_crypto_key);
+    mitosis_crypto_queue_init(&report_queue);
 
-
-    // Main loop, constantly sleep, waiting for RTC and gpio IRQs
+    // Main loop, send queued reports then sleep, waiting for RTC and gpio IRQs
     while(1)
     {
-        __SEV();
-        __WFE();
-        __WFE();
+        mitosis_crypto_job_t* job;
+        while ((job = mitosis_crypto_queue_peek(&report_queue)) != NULL)
+        {
+            encrypt_and_send(job);
+            mitosis_crypto_queue_release(&report_queue);
+        }
+
+        if (seed_pending)
+        {
+            rekey_from_seed();
+            seed_pending = false;
+            continue;
+        }
+
+        // Use idle time to compute the CTR keystream for upcoming reports,
+        // so encrypt_and_send() only has to XOR it in.
+        while (mitosis_aes_ctr_precompute(&crypto->encrypt, &keystream) &&
+               mitosis_crypto_queue_depth(&report_queue) == 0);
+
+        // Any interrupt since the queue was last checked has set the event
+        // register, so this returns straight away instead of stranding a job.
+        if (mitosis_crypto_queue_depth(&report_queue) == 0)
+        {
+            __WFE();
+        }
     }
 }
 
@@ -329,18 +729,22 @@ void GPIOTE_IRQHandler(void)
         //clear wakeup event
         NRF_GPIOTE->EVENTS_PORT = 0;
 
-        //enable rtc interupt triggers
-        nrf_drv_rtc_enable(&rtc_maint);
-        nrf_drv_rtc_enable(&rtc_deb);
+        if (asleep)
+        {
+            LATENCY_TIMER_START();
+            nrf_drv_rtc_enable(&rtc_maint);
+            asleep = false;
+        }
 
-        nrf_gpio_pin_clear(R01);
-        nrf_gpio_pin_clear(R02);
-        nrf_gpio_pin_clear(R03);
-        nrf_gpio_pin_clear(R04);
-        nrf_gpio_pin_clear(R05);
+        // Start a burst with a scan of the edge that caused it, rather
+        // than waiting a tick.
+        if (!scanning)
+        {
+            unwatch_keys();
+            start_scan_burst();
+            scan_keys();
+        }
 
-        //debouncing = false;
-        //debounce_ticks = 0;
         activity_ticks = 0;
     }
 }
@@ -354,7 +758,6 @@ void GPIOTE_IRQHandler(void)
 void  nrf_gzll_device_tx_success(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info)
 {
     uint32_t ack_payload_length = sizeof(ack_payload);
-    uint8_t mac_scratch[MITOSIS_CMAC_OUTPUT_SIZE];
 
     if (pipe != PIPE_NUMBER)
     {
@@ -362,35 +765,21 @@ void  nrf_gzll_device_tx_success(uint32_t pipe, nrf_gzll_device_tx_info_t tx_inf
         return;
     }
 
+    if (tx_done != tx_added)
+    {
+        LATENCY_RECORD(radio_latency, LATENCY_NOW() - tx_times[tx_done % TX_TIMES]);
+        ++tx_done;
+    }
+
     if (tx_info.payload_received_in_ack)
     {
         // If the receiver sent back payload, it's a new seed for encryption keys.
-        // Collect this packet and validate.
+        // Collect this packet and leave it for the main loop.
         nrf_gzll_fetch_packet_from_rx_fifo(pipe, (uint8_t*) &ack_payload, &ack_payload_length);
-        mitosis_cmac_compute(&receiver_crypto.cmac, ack_payload.payload, sizeof(ack_payload.payload), mac_scratch);
-        if (memcmp(mac_scratch, ack_payload.mac, sizeof(mac_scratch)) == 0)
+        if (!seed_pending)
         {
-            ++rekey_cmac_success;
-            receiver_crypto.encrypt.ctr.iv.counter = ack_payload.key_id;
-            if (mitosis_aes_ctr_decrypt(&receiver_crypto.encrypt, sizeof(ack_payload.seed), ack_payload.seed, mac_scratch))
-            {
-                // The seed packet validates! update the encryption keys.
-                data_payload.key_id = ack_payload.key_id;
-
-                #ifdef COMPILE_LEFT
-                mitosis_crypto_rekey(&crypto, left_keyboard_crypto_key, mac_scratch, sizeof(ack_payload.seed));
-                #elif defined(COMPILE_RIGHT)
-                mitosis_crypto_rekey(&crypto, right_keyboard_crypto_key, mac_scratch, sizeof(ack_payload.seed));
-                #endif
-            }
-            else
-            {
-                ++rekey_decrypt_failure;
-            }
-        }
-        else
-        {
-            ++rekey_cmac_failure;
+            seed_payload = ack_payload;
+            seed_pending = true;
         }
     }
     if (tx_info.num_tx_attempts > max_rtx)
@@ -403,7 +792,10 @@ void  nrf_gzll_device_tx_success(uint32_t pipe, nrf_gzll_device_tx_info_t tx_inf
 // no action is taken when a packet fails to send, this might need to change
 void nrf_gzll_device_tx_failed(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info)
 {
-
+    if (tx_done != tx_added)
+    {
+        ++tx_done;
+    }
 }
 
 // Callbacks not needed
@@ -10,6 +10,8 @@
 #include "nrf.h"
 #include "nrf_gzll.h"
 #include "mitosis-crypto.h"
+#include "mitosis-crypto-queue.h"
+#include "mitosis-latency.h"
 
 #define MAX_TEST_DATA_BYTES     (15U)                /**< max number of test bytes to be used for tx and rx. */
 #define UART_TX_BUF_SIZE 512                         /**< UART TX buffer size. */
@@ -23,9 +25,6 @@
 #define HWFC           false
 
 
-// ticks for inactive keyboard
-#define INACTIVE 10000
-
 // Binary printing
 #define BYTE_TO_BINARY_PATTERN "%c%c%c%c%c%c%c%c"
 #define BYTE_TO_BINARY(byte)  \
@@ -48,15 +47,48 @@ static mitosis_crypto_context_t left_crypto[3];
 static mitosis_crypto_context_t right_crypto[3];
 static mitosis_crypto_context_t receiver_crypto;
 
-// Whether a encryption/decryption operation is in progress.
-static volatile bool decrypting = false;
+// Verify only the newest of the key reports queued from a half.
+#ifndef RX_COALESCE_REPORTS
+#define RX_COALESCE_REPORTS 1
+#endif
+
+// Packets received from each half, by pipe, waiting to be verified by the
+// main loop. The Gazell callback is the only producer.
+#define RX_PIPES 2
+static mitosis_crypto_queue_t rx_queues[RX_PIPES];
+
+// A queued packet, held in the job's data.
+typedef struct _rx_packet_t {
+    union {
+        mitosis_crypto_data_payload_t payload;
+        mitosis_crypto_telemetry_payload_t telemetry;
+    };
+    uint32_t received;
+} rx_packet_t;
+
+_Static_assert(sizeof(rx_packet_t) <= MITOSIS_CRYPTO_JOB_DATA_SIZE);
+
+// The newest packet from a pipe whose queue was full. Once this is full every
+// later packet from the pipe replaces it, so it stays newer than anything
+// queued and is processed after the queue has drained. Each packet put here
+// counts as an overflow.
+typedef struct _rx_latest_t {
+    mitosis_crypto_job_t job;
+    volatile bool full;
+} rx_latest_t;
+
+static rx_latest_t rx_latest[RX_PIPES];
+static void process_rx_queue(void);
 
 static bool process_left = true;
 
+// Each step of key generation after the seed is collected does at most one
+// ECB operation, so a packet never waits behind more than one.
 typedef enum _crypto_rekey_state_t {
     key_not_ready,
     seed_ready,
     new_key_ready,
+    new_key_encrypted,
     new_key_payload_ready
 } crypto_rekey_state_t;
 
@@ -67,11 +99,16 @@ typedef struct _crypto_rekey_context_t {
     // Seed value used to generate new cryptographic contexts.
     uint8_t seed[15];
 
-    // Index into the seed array, used by the RNG when writing the seed.
-    uint8_t seed_index;
+    // Index into the seed array, used by the RNG interrupt when writing the
+    // seed.
+    volatile uint8_t seed_index;
+
+    // Current state of new key generation. The RNG interrupt only fills the
+    // seed while this is key_not_ready.
+    volatile crypto_rekey_state_t state;
 
-    // Current state of new key generation.
-    crypto_rekey_state_t state;
+    // Derivation of the next keys, one step per pass of the main loop.
+    mitosis_crypto_rekey_job_t job;
 
     // Key id for the current cryptographic keys and contexts.
     uint8_t key_id;
@@ -94,22 +131,84 @@ static uint8_t data_payload_left[NRF_GZLL_CONST_MAX_PAYLOAD_LENGTH];  ///< Place
 static uint8_t data_payload_right[NRF_GZLL_CONST_MAX_PAYLOAD_LENGTH];  ///< Placeholder for data payload received from host.
 static uint8_t data_buffer[11];
 
+// Replies to the diagnostic commands: a start byte, the command, the length
+// of the body that follows, then an XOR of all the bytes before it. Key
+// frames never start with the top bit set, so QMK can tell them apart.
+#define REPORT_START 0xE1
+#define REPORT_MAX_LENGTH (4 * sizeof(mitosis_latency_histogram_t))
+static uint8_t report_buffer[3 + REPORT_MAX_LENGTH + 1];
+
+// Body of the reply to the 't' command. The layout is the wire format; all
+// fields are little endian.
+typedef struct _keyboard_telemetry_t {
+    uint32_t packets;
+    uint32_t cmac_fail;
+    uint32_t decrypt_fail;
+    uint32_t skipped;
+    uint32_t replayed;
+    uint8_t rekey_state;
+    uint8_t key_id;
+    uint8_t new_key_id;
+    uint8_t key_id_confirmed;
+    // The keyboard's own statistics, as of the last page received of each.
+    uint32_t telemetry_packets;
+    uint32_t link[MITOSIS_TELEMETRY_VALUES];
+} keyboard_telemetry_t;
+
+typedef struct _receiver_telemetry_t {
+    keyboard_telemetry_t left;
+    keyboard_telemetry_t right;
+    uint32_t rx_overflows;
+    uint32_t rx_high_water;
+    uint32_t ecb_blocks;
+    uint32_t ecb_wakeups;
+    uint32_t rekey_steps;
+    uint32_t rekey_step_max;
+} receiver_telemetry_t;
+
+_Static_assert(sizeof(receiver_telemetry_t) == 160);
+_Static_assert(sizeof(receiver_telemetry_t) <= REPORT_MAX_LENGTH);
+
 // Debug helper variables
 extern nrf_gzll_error_code_t nrf_gzll_error_code;   ///< Error code
 uint8_t c;
 
 typedef struct _keyboard_stats_t {
+    uint32_t packets;
     uint32_t cmac_fail;
     uint32_t decrypt_fail;
-    uint32_t decrypt_collisions;
-    uint32_t active;
+    // Key reports dropped unverified because a newer one passed.
+    uint32_t skipped;
+    // Packets dropped because their counter had been seen, or was too old.
+    uint32_t replayed;
+    // Counters seen, for each of the three keys in use.
+    mitosis_replay_window_t replay[3];
+    // When the last valid report was received.
+    uint32_t last_seen;
     bool packet_received;
+    // Telemetry from the keyboard.
+    uint32_t telemetry_packets;
+    uint32_t link[MITOSIS_TELEMETRY_VALUES];
+    // Key change to report sent, as measured by the keyboard, and report
+    // received to sent on to QMK.
+    mitosis_latency_histogram_t keyboard_latency;
+    mitosis_latency_histogram_t receiver_latency;
+    // When the newest report with a key change not yet copied into the frame
+    // was received. Written by the main loop.
+    uint32_t fresh_received;
+    bool fresh_pending;
+    // The same for the frame waiting to go to QMK. Owned by the UART handler.
+    uint32_t frame_received;
+    bool frame_fresh;
 } keyboard_stats_t;
 
 keyboard_stats_t left_stats = { 0 };
 keyboard_stats_t right_stats = { 0 };
 
-uint64_t counter = 0;
+// Key generation steps taken, and the longest one in µs. Received packets
+// wait for at most one step.
+uint32_t rekey_steps = 0;
+uint32_t rekey_step_max = 0;
 
 static inline
 void crypto_rekey_context_init(crypto_rekey_context_t *state)
@@ -120,6 +219,93 @@ void crypto_rekey_context_init(crypto_rekey_context_t *state)
     state->key_id_confirmed = true;
 }
 
+// Note a key change being copied into the frame for QMK.
+static inline
+void latch_fresh(keyboard_stats_t *stats)
+{
+    if (stats->fresh_pending)
+    {
+        stats->frame_received = stats->fresh_received;
+        stats->frame_fresh = true;
+        stats->fresh_pending = false;
+    }
+}
+
+// Once a frame carrying a key change has gone, record how long it took.
+static inline
+void record_frame_sent(keyboard_stats_t *stats, uint32_t now)
+{
+    if (stats->frame_fresh)
+    {
+        mitosis_latency_record(&stats->receiver_latency, now - stats->frame_received);
+        stats->frame_fresh = false;
+    }
+}
+
+// Frame and send a reply whose body has been written to report_buffer + 3.
+static void send_report(uint8_t command, uint8_t length)
+{
+    uint8_t checksum = 0;
+
+    report_buffer[0] = REPORT_START;
+    report_buffer[1] = command;
+    report_buffer[2] = length;
+    for (int i = 0; i < 3 + length; i++)
+    {
+        checksum ^= report_buffer[i];
+    }
+    report_buffer[3 + length] = checksum;
+    nrf_drv_uart_tx(report_buffer, 3 + length + 1);
+}
+
+// Left keyboard, left receiver, right keyboard, right receiver.
+static void send_latency_report(void)
+{
+    uint8_t *histograms = report_buffer + 3;
+
+    memcpy(histograms, &left_stats.keyboard_latency, sizeof(mitosis_latency_histogram_t));
+    histograms += sizeof(mitosis_latency_histogram_t);
+    memcpy(histograms, &left_stats.receiver_latency, sizeof(mitosis_latency_histogram_t));
+    histograms += sizeof(mitosis_latency_histogram_t);
+    memcpy(histograms, &right_stats.keyboard_latency, sizeof(mitosis_latency_histogram_t));
+    histograms += sizeof(mitosis_latency_histogram_t);
+    memcpy(histograms, &right_stats.receiver_latency, sizeof(mitosis_latency_histogram_t));
+    send_report('l', 4 * sizeof(mitosis_latency_histogram_t));
+}
+
+static inline
+void fill_keyboard_telemetry(keyboard_telemetry_t *telemetry, const keyboard_stats_t *stats, const crypto_rekey_context_t *key_state)
+{
+    telemetry->packets = stats->packets;
+    telemetry->cmac_fail = stats->cmac_fail;
+    telemetry->decrypt_fail = stats->decrypt_fail;
+    telemetry->skipped = stats->skipped;
+    telemetry->replayed = stats->replayed;
+    telemetry->rekey_state = key_state->state;
+    telemetry->key_id = key_state->key_id;
+    telemetry->new_key_id = key_state->new_key_id;
+    telemetry->key_id_confirmed = key_state->key_id_confirmed;
+    telemetry->telemetry_packets = stats->telemetry_packets;
+    memcpy(telemetry->link, stats->link, sizeof(telemetry->link));
+}
+
+static void send_telemetry_report(void)
+{
+    receiver_telemetry_t telemetry;
+
+    fill_keyboard_telemetry(&telemetry.left, &left_stats, &left_key_state);
+    fill_keyboard_telemetry(&telemetry.right, &right_stats, &right_key_state);
+    telemetry.rx_overflows = rx_queues[0].overflows + rx_queues[1].overflows;
+    telemetry.rx_high_water = (rx_queues[0].high_water > rx_queues[1].high_water) ?
+        rx_queues[0].high_water : rx_queues[1].high_water;
+    telemetry.ecb_blocks = mitosis_aes_ecb_encrypt_count();
+    telemetry.ecb_wakeups = mitosis_aes_ecb_wakeup_count();
+    telemetry.rekey_steps = rekey_steps;
+    telemetry.rekey_step_max = rekey_step_max;
+    memcpy(report_buffer + 3, &telemetry, sizeof(telemetry));
+    send_report('t', sizeof(telemetry));
+}
+
 void mitosis_uart_handler(app_uart_evt_t * p_event)
 {
     if (p_event->evt_type == APP_UART_DATA)
@@ -129,6 +315,7 @@ void mitosis_uart_handler(app_uart_evt_t * p_event)
         if (left_stats.packet_received)
         {
             left_stats.packet_received = false;
+            latch_fresh(&left_stats);
 
             data_buffer[0] =  ((data_payload_left[0] & 1<<7) ? 1:0) << 0 |
                               ((data_payload_left[0] & 1<<6) ? 1:0) << 1 |
@@ -174,6 +361,7 @@ void mitosis_uart_handler(app_uart_evt_t * p_event)
         if (right_stats.packet_received)
         {
             right_stats.packet_received = false;
+            latch_fresh(&right_stats);
 
             data_buffer[1] =  ((data_payload_right[0] & 1<<7) ? 1:0) << 0 |
                               ((data_payload_right[0] & 1<<6) ? 1:0) << 1 |
@@ -219,6 +407,9 @@ void mitosis_uart_handler(app_uart_evt_t * p_event)
         {
             // sending data to QMK, and an end byte
             nrf_drv_uart_tx(data_buffer,11);
+            uint32_t now = mitosis_latency_now();
+            record_frame_sent(&left_stats, now);
+            record_frame_sent(&right_stats, now);
             // debugging help, for printing keystates to a serial console
             /*
             printf(BYTE_TO_BINARY_PATTERN " " \
@@ -246,27 +437,35 @@ void mitosis_uart_handler(app_uart_evt_t * p_event)
             // Give the UART time to read the buffer before it changes.
             nrf_delay_us(10);
         }
+        else if (p_event->data.value == 'l')
+        {
+            send_latency_report();
+        }
+        else if (p_event->data.value == 't')
+        {
+            send_telemetry_report();
+        }
         // if no packets recieved from keyboards in a few seconds, assume either
-        // out of range, or sleeping due to no keys pressed, update keystates to off
-        left_stats.active++;
-        right_stats.active++;
-        if (left_stats.active > INACTIVE)
+        // out of range, or sleeping due to no keys pressed, update keystates to off.
+        // Held keys are resent at least every MITOSIS_HEARTBEAT_MAX_MS.
+        uint32_t now = mitosis_latency_now();
+        if (now - left_stats.last_seen > MITOSIS_INACTIVE_MS * 1000)
         {
             data_buffer[0] = 0;
             data_buffer[2] = 0;
             data_buffer[4] = 0;
             data_buffer[6] = 0;
             data_buffer[8] = 0;
-            left_stats.active = 0;
+            left_stats.last_seen = now;
         }
-        if (right_stats.active > INACTIVE)
+        if (now - right_stats.last_seen > MITOSIS_INACTIVE_MS * 1000)
         {
             data_buffer[1] = 0;
             data_buffer[3] = 0;
             data_buffer[5] = 0;
             data_buffer[7] = 0;
             data_buffer[9] = 0;
-            right_stats.active = 0;
+            right_stats.last_seen = now;
         }
     }
     else if (p_event->evt_type == APP_UART_COMMUNICATION_ERROR)
@@ -275,6 +474,55 @@ void mitosis_uart_handler(app_uart_evt_t * p_event)
     }
 }
 
+// True while a half needs key generation steps from the main loop.
+static inline
+bool rekey_pending(const crypto_rekey_context_t *key_state)
+{
+    switch (key_state->state)
+    {
+        case key_not_ready:
+            return key_state->seed_index == sizeof(key_state->seed);
+        case new_key_payload_ready:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// True while the RNG interrupt is filling a half's seed.
+static inline
+bool seed_wanted(const crypto_rekey_context_t *key_state)
+{
+    return key_state->state == key_not_ready && key_state->seed_index < sizeof(key_state->seed);
+}
+
+// Hands each random byte to the first half still collecting a seed, and
+// stops the RNG once neither is.
+void RNG_IRQHandler(void)
+{
+    crypto_rekey_context_t *key_state = NULL;
+
+    if (seed_wanted(&left_key_state))
+    {
+        key_state = &left_key_state;
+    }
+    else if (seed_wanted(&right_key_state))
+    {
+        key_state = &right_key_state;
+    }
+    if (key_state != NULL)
+    {
+        key_state->seed[key_state->seed_index] = NRF_RNG->VALUE;
+        ++key_state->seed_index;
+    }
+    NRF_RNG->EVENTS_VALRDY = 0;
+
+    if (!seed_wanted(&left_key_state) && !seed_wanted(&right_key_state))
+    {
+        NRF_RNG->TASKS_STOP = 1;
+    }
+}
+
 static inline
 void update_rekey_state(
     crypto_rekey_context_t *key_state,
@@ -282,75 +530,82 @@ void update_rekey_state(
     keyboard_stats_t *stats,
     mitosis_crypto_key_type_t key_type)
 {
+    uint32_t start;
+
     switch (key_state->state)
     {
         case key_not_ready:
-            // Check if a random value is needed and if the RNG is ready and consume it.
-            if (key_state->seed_index < sizeof(key_state->seed) && NRF_RNG->EVENTS_VALRDY)
+            // Wait for the RNG interrupt to fill the seed.
+            if (key_state->seed_index == sizeof(key_state->seed))
             {
-                key_state->seed[key_state->seed_index++] = NRF_RNG->VALUE;
-                NRF_RNG->EVENTS_VALRDY = 0;
-                if (key_state->seed_index == sizeof(key_state->seed))
+                memcpy(key_state->ack_payload.seed, key_state->seed, sizeof(key_state->seed));
+                key_state->new_key_id = key_state->key_id + 1;
+                if (key_state->new_key_id == 0)
                 {
-                    memcpy(key_state->ack_payload.seed, key_state->seed, sizeof(key_state->seed));
-                    key_state->seed_index = 0;
-                    key_state->state = seed_ready;
-                    key_state->new_key_id = key_state->key_id + 1;
-                    if (key_state->new_key_id == 0)
-                    {
-                        // Key id 0 is special (it's the initial key), so skip it.
-                        key_state->new_key_id = 1;
-                    }
+                    // Key id 0 is special (it's the initial key), so skip it.
+                    key_state->new_key_id = 1;
                 }
-            }
-            break;
-        case seed_ready:
-            if (!decrypting)
-            {
-                decrypting = true;
-                if (mitosis_crypto_rekey(
+                if (mitosis_crypto_rekey_start(
+                        &key_state->job,
                         &crypto_contexts[(key_state->new_key_id & 0x1) + 1],
                         key_type,
                         key_state->ack_payload.seed,
                         sizeof(key_state->ack_payload.seed)))
                 {
-                    key_state->state = new_key_ready;
+                    // Leave key_not_ready first, so the RNG interrupt
+                    // doesn't write into the next seed early.
+                    key_state->state = seed_ready;
+                    key_state->seed_index = 0;
                 }
-                decrypting = false;
             }
-            else
+            return;
+        case seed_ready:
+            start = mitosis_latency_now();
+            if (!mitosis_crypto_rekey_step(&key_state->job))
+            {
+                // Start over with the same seed.
+                key_state->job.step = mitosis_rekey_step_salt;
+            }
+            else if (mitosis_crypto_rekey_finished(&key_state->job))
             {
-                ++stats->decrypt_collisions;
+                // The slot's counters start over with its new keys.
+                memset(&stats->replay[(key_state->new_key_id & 0x1) + 1], 0, sizeof(mitosis_replay_window_t));
+                key_state->state = new_key_ready;
             }
             break;
         case new_key_ready:
-            if (!decrypting)
+            start = mitosis_latency_now();
+            receiver_crypto.encrypt.ctr.iv.counter = key_state->new_key_id;
+            key_state->ack_payload.key_id = key_state->new_key_id;
+            if (mitosis_aes_ctr_encrypt(
+                    &receiver_crypto.encrypt,
+                    sizeof(key_state->ack_payload.seed),
+                    key_state->ack_payload.seed,
+                    key_state->ack_payload.seed))
             {
-                decrypting = true;
-                receiver_crypto.encrypt.ctr.iv.counter = key_state->new_key_id;
-                key_state->ack_payload.key_id = key_state->new_key_id;
-                if (mitosis_aes_ctr_encrypt(
-                        &receiver_crypto.encrypt,
-                        sizeof(key_state->ack_payload.seed),
-                        key_state->ack_payload.seed,
-                        key_state->ack_payload.seed) &&
-                    mitosis_cmac_compute(
-                        &receiver_crypto.cmac,
-                        key_state->ack_payload.payload,
-                        sizeof(key_state->ack_payload.payload),
-                        key_state->ack_payload.mac))
-                {
-                    key_state->state = new_key_payload_ready;
-                }
-                decrypting = false;
+                key_state->state = new_key_encrypted;
             }
-            else
+            break;
+        case new_key_encrypted:
+            start = mitosis_latency_now();
+            if (mitosis_cmac_compute_block(
+                    &receiver_crypto.cmac,
+                    key_state->ack_payload.payload,
+                    sizeof(key_state->ack_payload.payload),
+                    key_state->ack_payload.mac))
             {
-                ++stats->decrypt_collisions;
+                key_state->state = new_key_payload_ready;
             }
             break;
         default:
-            break;
+            return;
+    }
+
+    uint32_t elapsed = mitosis_latency_now() - start;
+    ++rekey_steps;
+    if (elapsed > rekey_step_max)
+    {
+        rekey_step_max = elapsed;
     }
 }
 
@@ -361,8 +616,12 @@ int main(void)
 
     // Enable error correction in the RNG module.
     NRF_RNG->CONFIG |= RNG_CONFIG_DERCEN_Msk;
-    // Tell the RNG to start running.
+    // Tell the RNG to start running; its interrupt collects the seeds.
     NRF_RNG->EVENTS_VALRDY = 0;
+    NRF_RNG->INTENSET = RNG_INTENSET_VALRDY_Msk;
+    NVIC_SetPriority(RNG_IRQn, APP_IRQ_PRIORITY_LOW);
+    NVIC_ClearPendingIRQ(RNG_IRQn);
+    NVIC_EnableIRQ(RNG_IRQn);
     NRF_RNG->TASKS_START = 1;
 
     // Initialize crypto keys
@@ -372,6 +631,11 @@ int main(void)
 
     crypto_rekey_context_init(&left_key_state);
     crypto_rekey_context_init(&right_key_state);
+    mitosis_crypto_queue_init(&rx_queues[0]);
+    mitosis_crypto_queue_init(&rx_queues[1]);
+
+    // Timestamps for the latency histograms
+    mitosis_latency_timer_start();
 
     memset(data_buffer, 0, sizeof(data_buffer));
     data_buffer[10] = 0xE0;
@@ -406,6 +670,9 @@ int main(void)
     // main loop
     while (true)
     {
+        // Received packets always go first; they hold up key presses.
+        process_rx_queue();
+
         if (process_left)
         {
             update_rekey_state(&left_key_state, left_crypto, &left_stats, left_keyboard_crypto_key);
@@ -416,116 +683,267 @@ int main(void)
         }
         // This flip/flops between next key generation for the left and right halves.
         process_left = !process_left;
-        counter++;
+
+        // Sleep until the next interrupt once there's nothing left to do,
+        // including a packet kept aside from a full queue. Any interrupt
+        // since the queues were last checked has set the event register, so
+        // this returns straight away instead of stranding a packet.
+        if (!rekey_pending(&left_key_state) && !rekey_pending(&right_key_state) &&
+            mitosis_crypto_queue_depth(&rx_queues[0]) == 0 &&
+            mitosis_crypto_queue_depth(&rx_queues[1]) == 0 &&
+            !rx_latest[0].full && !rx_latest[1].full)
+        {
+            __WFE();
+        }
     }
 }
 
+// Returns true if the packet was a valid report.
 static inline
-void process_received_packet(
+bool process_received_packet(
     mitosis_crypto_context_t crypto[],
     crypto_rekey_context_t* key_state,
     mitosis_crypto_data_payload_t *payload,
+    uint32_t received,
     keyboard_stats_t *stats,
     uint8_t *decrypted_payload,
     mitosis_crypto_seed_payload_t **ack_payload,
     uint32_t *ack_payload_length)
 {
-    uint8_t mac_scratch[MITOSIS_CMAC_OUTPUT_SIZE];
-    // If a crypto operation is in-progress, just skip the payload and continue.
-    // This could cause missing keypresses, but since the Gazell packet callback
-    // runs at high priority, it's unlikely this will happen.
-    // If it becomes a problem in the future, consider queueing packets and
-    // processing them in the main loop.
-    if (!decrypting)
+    uint8_t index = (payload->key_id == 0) ? 0 : (payload->key_id & 0x1) + 1;
+    ++stats->packets;
+    if (!mitosis_replay_check(&stats->replay[index], payload->counter))
+    {
+        ++stats->replayed;
+        // A half that restarted before confirming new keys sends with key
+        // id 0 from counter 0 again; it can't be told apart from a replay,
+        // so just offer it new keys.
+        if (payload->key_id == 0 && key_state->key_id_confirmed && key_state->state == new_key_payload_ready)
+        {
+            *ack_payload = &key_state->ack_payload;
+            *ack_payload_length = sizeof(key_state->ack_payload);
+        }
+        return false;
+    }
+    if (mitosis_cmac_verify_block(
+            &crypto[index].cmac,
+            payload->payload,
+            sizeof(payload->payload),
+            payload->mac))
     {
-        decrypting = true;
-        uint8_t index = (payload->key_id == 0) ? 0 : (payload->key_id & 0x1) + 1;
-        if (mitosis_cmac_compute(
-                &crypto[index].cmac,
-                payload->payload,
-                sizeof(payload->payload),
-                mac_scratch) &&
-            memcmp(payload->mac, mac_scratch, sizeof(payload->mac)) == 0)
+        // This is a valid message from the keyboard; decrypt it.
+        mitosis_replay_update(&stats->replay[index], payload->counter);
+        crypto[index].encrypt.ctr.iv.counter = payload->counter;
+        if (mitosis_aes_ctr_decrypt(
+                &crypto[index].encrypt,
+                sizeof(payload->data),
+                payload->data,
+                decrypted_payload))
         {
-            // This is a valid message from the keyboard; decrypt it.
-            crypto[index].encrypt.ctr.iv.counter = payload->counter;
-            if (mitosis_aes_ctr_decrypt(
-                    &crypto[index].encrypt,
-                    sizeof(payload->data),
-                    payload->data,
-                    decrypted_payload))
+            // Reports carrying a key change say how long ago it happened.
+            if (payload->age != 0)
             {
-                stats->packet_received = true;
-                stats->active = 0;
-                // If this packet confirms a key, mark it as confirmed and start
-                // generating the next key.
-                if (key_state->new_key_id != key_state->key_id && key_state->new_key_id == payload->key_id)
-                {
-                    key_state->key_id_confirmed = true;
-                    key_state->key_id = key_state->new_key_id;
-                    // On confirmation, generate new key
-                    key_state->state = key_not_ready;
-                }
-                // Tell the keyboard to rekey with this key material.
-                if ((payload->key_id == 0 || payload->counter > MITOSIS_REKEY_INTERVAL) &&
-                    key_state->key_id_confirmed && key_state->state == new_key_payload_ready)
-                {
-                    *ack_payload = &key_state->ack_payload;
-                    *ack_payload_length = sizeof(key_state->ack_payload);
-                }
+                mitosis_latency_record(&stats->keyboard_latency, payload->age * MITOSIS_AGE_UNIT_US);
+                stats->fresh_received = received;
+                stats->fresh_pending = true;
             }
-            else
+            stats->packet_received = true;
+            stats->last_seen = received;
+            // If this packet confirms a key, mark it as confirmed and start
+            // generating the next key.
+            if (key_state->new_key_id != key_state->key_id && key_state->new_key_id == payload->key_id)
             {
-                ++stats->decrypt_fail;
+                key_state->key_id_confirmed = true;
+                key_state->key_id = key_state->new_key_id;
+                // Key id 0 is only used again by a half that restarted,
+                // which counts from 0 again.
+                memset(&stats->replay[0], 0, sizeof(mitosis_replay_window_t));
+                // On confirmation, generate new key
+                key_state->state = key_not_ready;
+                NRF_RNG->TASKS_START = 1;
             }
-        }
-        else
-        {
-            ++stats->cmac_fail;
-            if (key_state->state == new_key_payload_ready)
+            // Tell the keyboard to rekey with this key material.
+            if ((payload->key_id == 0 || payload->counter > MITOSIS_REKEY_INTERVAL) &&
+                key_state->key_id_confirmed && key_state->state == new_key_payload_ready)
             {
-                // re-send the existing seed in case the keyboard reset and forgot.
                 *ack_payload = &key_state->ack_payload;
                 *ack_payload_length = sizeof(key_state->ack_payload);
             }
+            return true;
+        }
+        else
+        {
+            ++stats->decrypt_fail;
         }
-        decrypting = false;
     }
     else
     {
-        ++stats->decrypt_collisions;
+        ++stats->cmac_fail;
+        if (key_state->state == new_key_payload_ready)
+        {
+            // re-send the existing seed in case the keyboard reset and forgot.
+            *ack_payload = &key_state->ack_payload;
+            *ack_payload_length = sizeof(key_state->ack_payload);
+        }
     }
+    return false;
 }
 
+static inline
+void process_telemetry_packet(
+    mitosis_crypto_context_t crypto[],
+    mitosis_crypto_telemetry_payload_t *payload,
+    keyboard_stats_t *stats)
+{
+    uint8_t index = (payload->key_id == 0) ? 0 : (payload->key_id & 0x1) + 1;
+    uint32_t values[MITOSIS_TELEMETRY_PAGE_VALUES];
 
-// Callbacks not needed in this example.
-void nrf_gzll_device_tx_success(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info) {}
-void nrf_gzll_device_tx_failed(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info) {}
-void nrf_gzll_disabled() {}
+    ++stats->packets;
+    if (!mitosis_replay_check(&stats->replay[index], payload->counter))
+    {
+        ++stats->replayed;
+        return;
+    }
+    if (!mitosis_cmac_verify_block(
+            &crypto[index].cmac,
+            payload->payload,
+            sizeof(payload->payload),
+            payload->mac))
+    {
+        ++stats->cmac_fail;
+        return;
+    }
+    mitosis_replay_update(&stats->replay[index], payload->counter);
+    crypto[index].encrypt.ctr.iv.counter = payload->counter;
+    if (!mitosis_aes_ctr_decrypt(
+            &crypto[index].encrypt,
+            sizeof(payload->values),
+            (uint8_t*) payload->values,
+            (uint8_t*) values))
+    {
+        ++stats->decrypt_fail;
+        return;
+    }
+    if (payload->page < MITOSIS_TELEMETRY_PAGES)
+    {
+        memcpy(&stats->link[payload->page * MITOSIS_TELEMETRY_PAGE_VALUES], values, sizeof(values));
+        ++stats->telemetry_packets;
+    }
+}
 
-// If a data packet was received, identify half, and decrypt it.
-void nrf_gzll_host_rx_data_ready(uint32_t pipe, nrf_gzll_host_rx_info_t rx_info)
+
+// Verify and decrypt every packet queued from one pipe, and queue any ACK
+// payload it earns. Every key report holds the whole state of its half, so
+// when coalescing only the newest valid one matters: reports are tried from
+// the newest back, and any older than the first that passes are skipped.
+// Gazell delivers a pipe's packets in order, so the newest report is the
+// last one queued; its counter restarts whenever the keys change.
+static void process_rx_pipe(uint32_t pipe)
 {
-    mitosis_crypto_data_payload_t payload;
-    uint32_t payload_length = sizeof(payload);
+    mitosis_crypto_context_t *crypto = (pipe == 0) ? left_crypto : right_crypto;
+    crypto_rekey_context_t *key_state = (pipe == 0) ? &left_key_state : &right_key_state;
+    keyboard_stats_t *stats = (pipe == 0) ? &left_stats : &right_stats;
+    uint8_t *data_payload = (pipe == 0) ? data_payload_left : data_payload_right;
+    uint32_t depth;
+    // Key reports from tried on have been processed already, and those
+    // before skip_below are skipped.
+    uint32_t tried;
+    uint32_t skip_below = 0;
+
+    if (mitosis_crypto_queue_peek(&rx_queues[pipe]) == NULL)
+    {
+        return;
+    }
+    depth = mitosis_crypto_queue_depth(&rx_queues[pipe]);
+    tried = depth;
+
+#if RX_COALESCE_REPORTS
+    while (tried > 0)
+    {
+        mitosis_crypto_job_t* job = mitosis_crypto_queue_at(&rx_queues[pipe], --tried);
+        rx_packet_t *packet = (rx_packet_t*) job->data;
+        uint32_t ack_payload_length = 0;
+        mitosis_crypto_seed_payload_t *ack_payload = NULL;
+        bool valid;
+
+        if (job->length == sizeof(packet->telemetry))
+        {
+            continue;
+        }
+        valid = process_received_packet(crypto, key_state, &packet->payload, packet->received, stats, data_payload, &ack_payload, &ack_payload_length);
+        if (ack_payload != NULL)
+        {
+            nrf_gzll_add_packet_to_tx_fifo(pipe, (uint8_t*) ack_payload, ack_payload_length);
+        }
+        if (valid)
+        {
+            skip_below = tried;
+            break;
+        }
+    }
+#endif
+
+    for (uint32_t idx = 0; idx < depth; ++idx)
+    {
+        mitosis_crypto_job_t* job = mitosis_crypto_queue_peek(&rx_queues[pipe]);
+        rx_packet_t *packet = (rx_packet_t*) job->data;
+        uint32_t ack_payload_length = 0;
+        mitosis_crypto_seed_payload_t *ack_payload = NULL;
+
+        if (job->length == sizeof(packet->telemetry))
+        {
+            process_telemetry_packet(crypto, &packet->telemetry, stats);
+        }
+        else if (idx < skip_below)
+        {
+            ++stats->skipped;
+        }
+        else if (idx < tried)
+        {
+            process_received_packet(crypto, key_state, &packet->payload, packet->received, stats, data_payload, &ack_payload, &ack_payload_length);
+        }
+        mitosis_crypto_queue_release(&rx_queues[pipe]);
+
+        //load ACK payload into TX queue
+        if (ack_payload != NULL)
+        {
+            nrf_gzll_add_packet_to_tx_fifo(pipe, (uint8_t*) ack_payload, ack_payload_length);
+        }
+    }
+}
+
+// Process the packet kept from a pipe's last overflow, once everything queued
+// before it is done.
+static void process_rx_latest(uint32_t pipe)
+{
+    mitosis_crypto_context_t *crypto = (pipe == 0) ? left_crypto : right_crypto;
+    crypto_rekey_context_t *key_state = (pipe == 0) ? &left_key_state : &right_key_state;
+    keyboard_stats_t *stats = (pipe == 0) ? &left_stats : &right_stats;
+    uint8_t *data_payload = (pipe == 0) ? data_payload_left : data_payload_right;
     uint32_t ack_payload_length = 0;
     mitosis_crypto_seed_payload_t *ack_payload = NULL;
+    mitosis_crypto_job_t job;
+    rx_packet_t *packet = (rx_packet_t*) job.data;
 
-    if (pipe == 0)
+    if (!rx_latest[pipe].full || mitosis_crypto_queue_depth(&rx_queues[pipe]) != 0)
     {
-        // Pop packet and write payload to temp storage for verification.
-        nrf_gzll_fetch_packet_from_rx_fifo(pipe, (uint8_t*) &payload, &payload_length);
-        process_received_packet(left_crypto, &left_key_state, &payload, &left_stats, data_payload_left, &ack_payload, &ack_payload_length);
+        return;
     }
-    else if (pipe == 1)
+
+    // Take a copy, so the radio interrupt can replace it straight away.
+    __disable_irq();
+    job = rx_latest[pipe].job;
+    rx_latest[pipe].full = false;
+    __enable_irq();
+
+    if (job.length == sizeof(packet->telemetry))
     {
-        // Pop packet and write payload to temp storage for verification.
-        nrf_gzll_fetch_packet_from_rx_fifo(pipe, (uint8_t*) &payload, &payload_length);
-        process_received_packet(right_crypto, &right_key_state, &payload, &right_stats, data_payload_right, &ack_payload, &ack_payload_length);
+        process_telemetry_packet(crypto, &packet->telemetry, stats);
+    }
+    else
+    {
+        process_received_packet(crypto, key_state, &packet->payload, packet->received, stats, data_payload, &ack_payload, &ack_payload_length);
     }
-
-    // not sure if required, I guess if enough packets are missed during blocking uart
-    nrf_gzll_flush_rx_fifo(pipe);
 
     //load ACK payload into TX queue
     if (ack_payload != NULL)
@@ -533,3 +951,72 @@ void nrf_gzll_host_rx_data_ready(uint32_t pipe, nrf_gzll_host_rx_info_t rx_info)
         nrf_gzll_add_packet_to_tx_fifo(pipe, (uint8_t*) ack_payload, ack_payload_length);
     }
 }
+
+static void process_rx_queue(void)
+{
+    process_rx_pipe(0);
+    process_rx_latest(0);
+    process_rx_pipe(1);
+    process_rx_latest(1);
+}
+
+
+// Callbacks not needed in this example.
+void nrf_gzll_device_tx_success(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info) {}
+void nrf_gzll_device_tx_failed(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info) {}
+void nrf_gzll_disabled() {}
+
+// If data packets were received, queue them all for the main loop to verify.
+void nrf_gzll_host_rx_data_ready(uint32_t pipe, nrf_gzll_host_rx_info_t rx_info)
+{
+    static rx_packet_t discard;
+
+    while (nrf_gzll_get_rx_fifo_packet_count(pipe) > 0)
+    {
+        // If the pipe's queue is full, or a packet is already waiting in
+        // rx_latest, the packet is counted in the queue's overflows and
+        // replaces the one in rx_latest. Packets on other pipes are dropped.
+        mitosis_crypto_job_t* job = NULL;
+        bool queued = false;
+        rx_packet_t *packet;
+
+        if (pipe < RX_PIPES)
+        {
+            if (!rx_latest[pipe].full)
+            {
+                job = mitosis_crypto_queue_reserve(&rx_queues[pipe]);
+                queued = (job != NULL);
+            }
+            else
+            {
+                ++rx_queues[pipe].overflows;
+            }
+            if (!queued)
+            {
+                job = &rx_latest[pipe].job;
+            }
+        }
+        packet = (job != NULL) ? (rx_packet_t*) job->data : &discard;
+        uint32_t payload_length = sizeof(packet->telemetry);
+
+        // Pop packet and write payload straight into the queue.
+        if (!nrf_gzll_fetch_packet_from_rx_fifo(pipe, (uint8_t*) &packet->payload, &payload_length))
+        {
+            break;
+        }
+        if (job != NULL)
+        {
+            packet->received = mitosis_latency_now();
+            job->pipe = pipe;
+            job->length = payload_length;
+            if (queued)
+            {
+                mitosis_crypto_queue_commit(&rx_queues[pipe]);
+            }
+            else
+            {
+                rx_latest[pipe].full = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/*
+    Linked into each firmware image to export its entry points to the
+    simulator. The image is built with SIM_FIRMWARE set to the name of the
+    sim_firmware_t to define, which is the only symbol left global. The
+    image's .data and .bss are renamed after it, so the linker marks where
+    they start and end.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include "nrf.h"
+#include "nrf_gzll.h"
+#include "sim.h"
+
+#define SIM_CONCAT_(a, b) a##b
+#define SIM_CONCAT(a, b) SIM_CONCAT_(a, b)
+#define SIM_SECTION_START(section) SIM_CONCAT(SIM_CONCAT(__start_, SIM_FIRMWARE), section)
+#define SIM_SECTION_STOP(section) SIM_CONCAT(SIM_CONCAT(__stop_, SIM_FIRMWARE), section)
+
+extern uint8_t SIM_SECTION_START(_data)[];
+extern uint8_t SIM_SECTION_STOP(_data)[];
+extern uint8_t SIM_SECTION_START(_bss)[];
+extern uint8_t SIM_SECTION_STOP(_bss)[];
+
+int main(void);
+
+// Handlers the firmware doesn't define stay NULL.
+void GPIOTE_IRQHandler(void) __attribute__((weak));
+void RNG_IRQHandler(void) __attribute__((weak));
+void ECB_IRQHandler(void) __attribute__((weak));
+
+const sim_firmware_t SIM_FIRMWARE =
+{
+    .name = SIM_FIRMWARE_NAME,
+    .main = main,
+    .irq_handlers =
+    {
+        [GPIOTE_IRQn] = GPIOTE_IRQHandler,
+        [RNG_IRQn] = RNG_IRQHandler,
+        [ECB_IRQn] = ECB_IRQHandler,
+    },
+    .gzll_device_tx_success = nrf_gzll_device_tx_success,
+    .gzll_device_tx_failed = nrf_gzll_device_tx_failed,
+    .gzll_host_rx_data_ready = nrf_gzll_host_rx_data_ready,
+    .gzll_disabled = nrf_gzll_disabled,
+    .data_start = SIM_SECTION_START(_data),
+    .data_end = SIM_SECTION_STOP(_data),
+    .bss_start = SIM_SECTION_START(_bss),
+    .bss_end = SIM_SECTION_STOP(_bss),
+};
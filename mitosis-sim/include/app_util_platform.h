@@ -0,0 +1,7 @@
+#ifndef APP_UTIL_PLATFORM_H__
+#define APP_UTIL_PLATFORM_H__
+
+#define APP_IRQ_PRIORITY_HIGH 1
+#define APP_IRQ_PRIORITY_LOW 3
+
+#endif
@@ -0,0 +1,129 @@
+/*
+    Simulated nRF51 device header. Peripheral blocks belong to whichever
+    simulated device is running, and every access gives the simulator a
+    chance to advance time and deliver interrupts.
+*/
+
+#ifndef NRF_H
+#define NRF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NRF51
+
+typedef enum {
+    POWER_CLOCK_IRQn = 0,
+    RADIO_IRQn = 1,
+    UART0_IRQn = 2,
+    SPI0_TWI0_IRQn = 3,
+    SPI1_TWI1_IRQn = 4,
+    GPIOTE_IRQn = 6,
+    ADC_IRQn = 7,
+    TIMER0_IRQn = 8,
+    TIMER1_IRQn = 9,
+    TIMER2_IRQn = 10,
+    RTC0_IRQn = 11,
+    TEMP_IRQn = 12,
+    RNG_IRQn = 13,
+    ECB_IRQn = 14,
+    CCM_AAR_IRQn = 15,
+    WDT_IRQn = 16,
+    RTC1_IRQn = 17,
+    QDEC_IRQn = 18,
+    LPCOMP_IRQn = 19,
+    SWI0_IRQn = 20,
+    SWI1_IRQn = 21,
+    SWI2_IRQn = 22,
+    SWI3_IRQn = 23,
+    SWI4_IRQn = 24,
+    SWI5_IRQn = 25
+} IRQn_Type;
+
+typedef struct {
+    volatile uint32_t OUT;
+    volatile uint32_t IN;
+    volatile uint32_t DIR;
+    volatile uint32_t PIN_CNF[32];
+} NRF_GPIO_Type;
+
+typedef struct {
+    volatile uint32_t EVENTS_PORT;
+    volatile uint32_t INTENSET;
+    volatile uint32_t INTENCLR;
+} NRF_GPIOTE_Type;
+
+typedef struct {
+    volatile uint32_t TASKS_START;
+    volatile uint32_t TASKS_STOP;
+    volatile uint32_t EVENTS_VALRDY;
+    volatile uint32_t SHORTS;
+    volatile uint32_t INTENSET;
+    volatile uint32_t INTENCLR;
+    volatile uint32_t CONFIG;
+    volatile uint32_t VALUE;
+} NRF_RNG_Type;
+
+typedef struct {
+    volatile uint32_t TASKS_STARTECB;
+    volatile uint32_t TASKS_STOPECB;
+    volatile uint32_t EVENTS_ENDECB;
+    volatile uint32_t EVENTS_ERRORECB;
+    volatile uint32_t INTENSET;
+    volatile uint32_t INTENCLR;
+    // 32 bits on the chip; pointer sized here so it can hold a host address.
+    volatile uintptr_t ECBDATAPTR;
+} NRF_ECB_Type;
+
+typedef struct {
+    volatile uint32_t TASKS_START;
+    volatile uint32_t TASKS_STOP;
+    volatile uint32_t TASKS_COUNT;
+    volatile uint32_t TASKS_CLEAR;
+    volatile uint32_t TASKS_CAPTURE[4];
+    volatile uint32_t MODE;
+    volatile uint32_t BITMODE;
+    volatile uint32_t PRESCALER;
+    volatile uint32_t CC[4];
+} NRF_TIMER_Type;
+
+#define GPIOTE_INTENSET_PORT_Msk (1UL << 31)
+#define RNG_CONFIG_DERCEN_Msk (1UL << 0)
+#define RNG_INTENSET_VALRDY_Msk (1UL << 0)
+#define RNG_INTENCLR_VALRDY_Msk (1UL << 0)
+#define ECB_INTENSET_ENDECB_Msk (1UL << 0)
+#define ECB_INTENSET_ERRORECB_Msk (1UL << 1)
+#define UART_BAUDRATE_BAUDRATE_Baud1M (0x10000000UL)
+#define TIMER_MODE_MODE_Timer (0UL)
+#define TIMER_BITMODE_BITMODE_32Bit (3UL)
+
+NRF_GPIO_Type* sim_nrf_gpio(void);
+NRF_GPIOTE_Type* sim_nrf_gpiote(void);
+NRF_RNG_Type* sim_nrf_rng(void);
+NRF_ECB_Type* sim_nrf_ecb(void);
+NRF_TIMER_Type* sim_nrf_timer0(void);
+
+#define NRF_GPIO (sim_nrf_gpio())
+#define NRF_GPIOTE (sim_nrf_gpiote())
+#define NRF_RNG (sim_nrf_rng())
+#define NRF_ECB (sim_nrf_ecb())
+#define NRF_TIMER0 (sim_nrf_timer0())
+
+// Core and NVIC intrinsics.
+void __WFE(void);
+void __WFI(void);
+void __SEV(void);
+void __NOP(void);
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+uint32_t __get_IPSR(void);
+
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void NVIC_SetPendingIRQ(IRQn_Type irq);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+
+#endif
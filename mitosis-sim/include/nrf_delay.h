@@ -0,0 +1,9 @@
+#ifndef _NRF_DELAY_H
+#define _NRF_DELAY_H
+
+#include <stdint.h>
+
+void nrf_delay_us(uint32_t number_of_us);
+void nrf_delay_ms(uint32_t number_of_ms);
+
+#endif
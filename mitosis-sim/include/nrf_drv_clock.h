@@ -0,0 +1,11 @@
+#ifndef NRF_DRV_CLOCK_H__
+#define NRF_DRV_CLOCK_H__
+
+#include "sdk_errors.h"
+
+typedef void (*nrf_drv_clock_handler_t)(void);
+
+ret_code_t nrf_drv_clock_init(void);
+void nrf_drv_clock_lfclk_request(nrf_drv_clock_handler_t handler);
+
+#endif
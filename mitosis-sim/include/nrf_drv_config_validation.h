@@ -0,0 +1 @@
+// The simulator doesn't check driver configuration.
@@ -0,0 +1,51 @@
+#ifndef NRF_DRV_RTC_H
+#define NRF_DRV_RTC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "nrf_drv_config.h"
+#include "sdk_errors.h"
+
+#define RTC_INPUT_FREQ 32768
+#define RTC_FREQ_TO_PRESCALER(FREQ) (uint16_t)(((RTC_INPUT_FREQ) / (FREQ)) - 1)
+#define RTC_COUNTER_COUNTER_Msk 0xFFFFFFUL
+#define RTC_WRAP(val) ((val) & RTC_COUNTER_COUNTER_Msk)
+
+typedef enum {
+    NRF_DRV_RTC_INT_COMPARE0 = 0,
+    NRF_DRV_RTC_INT_COMPARE1 = 1,
+    NRF_DRV_RTC_INT_COMPARE2 = 2,
+    NRF_DRV_RTC_INT_COMPARE3 = 3,
+    NRF_DRV_RTC_INT_TICK = 4,
+    NRF_DRV_RTC_INT_OVERFLOW = 5
+} nrf_drv_rtc_int_type_t;
+
+typedef struct {
+    uint8_t instance_id;
+    // Stands in for the default config the real driver takes from
+    // nrf_drv_config.h when init is passed NULL.
+    uint16_t prescaler;
+} nrf_drv_rtc_t;
+
+typedef struct {
+    uint16_t prescaler;
+} nrf_drv_rtc_config_t;
+
+#define NRF_DRV_RTC_INSTANCE(id) \
+{ \
+    .instance_id = (id), \
+    .prescaler = RTC_FREQ_TO_PRESCALER(RTC##id##_CONFIG_FREQUENCY), \
+}
+
+typedef void (*nrf_drv_rtc_handler_t)(nrf_drv_rtc_int_type_t int_type);
+
+ret_code_t nrf_drv_rtc_init(nrf_drv_rtc_t const * const p_instance, nrf_drv_rtc_config_t const * p_config, nrf_drv_rtc_handler_t handler);
+void nrf_drv_rtc_enable(nrf_drv_rtc_t const * const p_instance);
+void nrf_drv_rtc_disable(nrf_drv_rtc_t const * const p_instance);
+void nrf_drv_rtc_tick_enable(nrf_drv_rtc_t const * const p_instance, bool enable_irq);
+void nrf_drv_rtc_tick_disable(nrf_drv_rtc_t const * const p_instance);
+ret_code_t nrf_drv_rtc_cc_set(nrf_drv_rtc_t const * const p_instance, uint32_t channel, uint32_t val, bool enable_irq);
+ret_code_t nrf_drv_rtc_cc_disable(nrf_drv_rtc_t const * const p_instance, uint32_t channel);
+uint32_t nrf_drv_rtc_counter_get(nrf_drv_rtc_t const * const p_instance);
+
+#endif
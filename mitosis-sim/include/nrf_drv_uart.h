@@ -0,0 +1,9 @@
+#ifndef NRF_DRV_UART_H
+#define NRF_DRV_UART_H
+
+#include <stdint.h>
+#include "sdk_errors.h"
+
+ret_code_t nrf_drv_uart_tx(uint8_t const * const p_data, uint8_t length);
+
+#endif
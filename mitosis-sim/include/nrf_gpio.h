@@ -0,0 +1,23 @@
+#ifndef NRF_GPIO_H__
+#define NRF_GPIO_H__
+
+#include "nrf.h"
+
+typedef enum {
+    NRF_GPIO_PIN_NOPULL,
+    NRF_GPIO_PIN_PULLDOWN,
+    NRF_GPIO_PIN_PULLUP = 3
+} nrf_gpio_pin_pull_t;
+
+typedef enum {
+    NRF_GPIO_PIN_NOSENSE,
+    NRF_GPIO_PIN_SENSE_LOW = 3,
+    NRF_GPIO_PIN_SENSE_HIGH = 2
+} nrf_gpio_pin_sense_t;
+
+void nrf_gpio_cfg_sense_input(uint32_t pin_number, nrf_gpio_pin_pull_t pull_config, nrf_gpio_pin_sense_t sense_config);
+void nrf_gpio_cfg_output(uint32_t pin_number);
+void nrf_gpio_pin_set(uint32_t pin_number);
+void nrf_gpio_pin_clear(uint32_t pin_number);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+    Simulated Gazell link layer. Same API as the SDK's nrf_gzll.h for the
+    calls the mitosis firmware makes; packets travel over the simulator's
+    virtual radio instead of the air.
+*/
+
+#ifndef NRF_GZLL_H__
+#define NRF_GZLL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NRF_GZLL_CONST_PIPE_COUNT 8
+#define NRF_GZLL_CONST_FIFO_LENGTH 3
+#define NRF_GZLL_CONST_MAX_PAYLOAD_LENGTH 32
+
+#define NRF_GZLL_DEFAULT_MAX_TX_ATTEMPTS 0 // 0 means retry forever
+
+typedef enum {
+    NRF_GZLL_MODE_DEVICE,
+    NRF_GZLL_MODE_HOST,
+    NRF_GZLL_MODE_SUSPEND
+} nrf_gzll_mode_t;
+
+typedef enum {
+    NRF_GZLL_ERROR_CODE_NO_ERROR = 0,
+    NRF_GZLL_ERROR_CODE_FAILED_TO_INITIALIZE = 1,
+    NRF_GZLL_ERROR_CODE_ATTEMPTED_TO_CONFIGURE_WHEN_ENABLED = 2,
+    NRF_GZLL_ERROR_CODE_INVALID_PIPE = 4,
+    NRF_GZLL_ERROR_CODE_INVALID_MODE = 5,
+    NRF_GZLL_ERROR_CODE_INVALID_PAYLOAD_LENGTH = 6,
+    NRF_GZLL_ERROR_CODE_INSUFFICIENT_PACKETS_AVAILABLE = 8,
+    NRF_GZLL_ERROR_CODE_ATTEMPTED_TO_ADD_TO_FULL_FIFO = 9,
+    NRF_GZLL_ERROR_CODE_ATTEMPTED_TO_FETCH_FROM_EMPTY_FIFO = 10,
+    NRF_GZLL_ERROR_CODE_ATTEMPTED_TO_FLUSH_WHEN_ENABLED = 11,
+    NRF_GZLL_ERROR_CODE_RX_BUFFER_TOO_SMALL = 15
+} nrf_gzll_error_code_t;
+
+typedef struct {
+    bool payload_received_in_ack;
+    uint16_t num_tx_attempts;
+    uint16_t num_channel_switches;
+    int16_t rssi;
+} nrf_gzll_device_tx_info_t;
+
+typedef struct {
+    bool payload_received_in_ack;
+    int16_t rssi;
+} nrf_gzll_host_rx_info_t;
+
+bool nrf_gzll_init(nrf_gzll_mode_t mode);
+bool nrf_gzll_enable(void);
+void nrf_gzll_disable(void);
+bool nrf_gzll_is_enabled(void);
+
+bool nrf_gzll_set_max_tx_attempts(uint16_t max_tx_attempts);
+bool nrf_gzll_set_base_address_0(uint32_t base_address);
+bool nrf_gzll_set_base_address_1(uint32_t base_address);
+
+bool nrf_gzll_add_packet_to_tx_fifo(uint32_t pipe, uint8_t * p_payload, uint32_t length);
+bool nrf_gzll_fetch_packet_from_rx_fifo(uint32_t pipe, uint8_t * p_payload, uint32_t * p_length);
+int32_t nrf_gzll_get_tx_fifo_packet_count(uint32_t pipe);
+int32_t nrf_gzll_get_rx_fifo_packet_count(uint32_t pipe);
+bool nrf_gzll_flush_tx_fifo(uint32_t pipe);
+bool nrf_gzll_flush_rx_fifo(uint32_t pipe);
+
+nrf_gzll_error_code_t nrf_gzll_get_error_code(void);
+
+// Callbacks implemented by the application.
+void nrf_gzll_device_tx_success(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info);
+void nrf_gzll_device_tx_failed(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info);
+void nrf_gzll_host_rx_data_ready(uint32_t pipe, nrf_gzll_host_rx_info_t rx_info);
+void nrf_gzll_disabled(void);
+
+#endif
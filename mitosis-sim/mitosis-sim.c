@@ -0,0 +1,628 @@
+/*
+    Runs the keyboard halves and receiver firmware together on the host.
+
+    A seeded typist presses and releases keys on both halves while a stand-in
+    for QMK polls the receiver over UART every millisecond, the way
+    matrix.c does. Every key change is timed from the switch closing to the
+    first UART frame that reports it. Output is a text summary by default,
+    or JSON with --json; the same seed always gives the same results.
+
+    The radio link can be made lossy, with independent loss on data and
+    ACKs and optional bursts, to see how retransmission limits and dropped
+    packets on the receiver show up as key latency.
+
+    Switches can be made to bounce, and the keyboards built with eager
+    presses (the default) or with presses debounced like releases, to compare
+    press and release latency under each.
+
+    Once the run is over the receiver is asked for its latency histograms
+    and telemetry, so the firmware's own measurements can be checked against
+    the simulator's.
+
+    The receiver or the left half can be power cycled partway through a
+    run, to check that the link recovers and picks up fresh keys.
+*/
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "interphase.h"
+#include "mitosis-crypto.h"
+#include "mitosis-latency.h"
+#include "sim.h"
+
+#define DEFAULT_SECONDS 10
+#define QMK_POLL_INTERVAL SIM_MS(1)
+#define FRAME_LENGTH 11
+#define FRAME_END 0xE0
+#define REPORT_START 0xE1
+#define REPORT_MAX_LENGTH (3 + 255 + 1)
+#define LATENCY_HISTOGRAMS 4
+// How long to wait for the replies after the run.
+#define REPORT_TIME SIM_MS(10)
+
+#define HALVES 2
+#define KEY_COUNT (HALVES * SIM_MATRIX_ROWS * SIM_MATRIX_COLUMNS)
+#define MAX_SAMPLES 200000
+
+// Typing model: hold times and gaps between strokes, in milliseconds.
+#define HOLD_MIN_MS 30
+#define HOLD_MAX_MS 150
+#define GAP_MIN_MS 40
+#define GAP_MAX_MS 300
+// Typing stops this long before the end so every change has time to land.
+#define SETTLE_TIME SIM_MS(500)
+// Number of times a bouncing switch flips back before it settles.
+#define BOUNCES 2
+
+extern const sim_firmware_t sim_firmware_receiver;
+extern const sim_firmware_t sim_firmware_receiver_uncoalesced;
+extern const sim_firmware_t sim_firmware_keyboard_left;
+extern const sim_firmware_t sim_firmware_keyboard_right;
+extern const sim_firmware_t sim_firmware_keyboard_left_deferred;
+extern const sim_firmware_t sim_firmware_keyboard_right_deferred;
+
+typedef struct _key_state_t {
+    bool pressed;
+    // Waiting for the receiver to report the latest change.
+    bool pending;
+    // The receiver is reporting a state the key isn't in.
+    bool spurious;
+    sim_time_t changed;
+} key_state_t;
+
+typedef struct _latency_stats_t {
+    uint32_t changes;
+    uint32_t reported;
+    uint32_t superseded;
+    uint32_t missed;
+    // Times the receiver reported a key change that didn't happen, e.g.
+    // dropping a held key.
+    uint32_t spurious;
+    uint32_t frames;
+    uint32_t bad_frames;
+} latency_stats_t;
+
+static sim_device_t* receiver;
+static sim_device_t* halves[HALVES];
+static key_state_t keys[KEY_COUNT];
+typedef struct _sample_set_t {
+    uint32_t values[MAX_SAMPLES];
+    uint32_t count;
+} sample_set_t;
+
+static sample_set_t samples;
+static sample_set_t press_samples;
+static sample_set_t release_samples;
+static sim_time_t bounce_time = 0;
+static uint32_t hold_max_ms = HOLD_MAX_MS;
+static latency_stats_t stats;
+static sim_time_t typing_end;
+
+static uint8_t frame[REPORT_MAX_LENGTH];
+static size_t frame_length = 0;
+static sim_time_t polling_end;
+
+// In the order the receiver sends them.
+static const char* latency_names[LATENCY_HISTOGRAMS] = {
+    "left keyboard", "left receiver", "right keyboard", "right receiver"
+};
+static mitosis_latency_histogram_t firmware_latency[LATENCY_HISTOGRAMS];
+static bool have_firmware_latency = false;
+
+// Mirrors the receiver's reply to 't'.
+typedef struct _keyboard_telemetry_t {
+    uint32_t packets;
+    uint32_t cmac_fail;
+    uint32_t decrypt_fail;
+    uint32_t skipped;
+    uint32_t replayed;
+    uint8_t rekey_state;
+    uint8_t key_id;
+    uint8_t new_key_id;
+    uint8_t key_id_confirmed;
+    uint32_t telemetry_packets;
+    uint32_t link[MITOSIS_TELEMETRY_VALUES];
+} keyboard_telemetry_t;
+
+typedef struct _receiver_telemetry_t {
+    keyboard_telemetry_t halves[HALVES];
+    uint32_t rx_overflows;
+    uint32_t rx_high_water;
+    uint32_t ecb_blocks;
+    uint32_t ecb_wakeups;
+    uint32_t rekey_steps;
+    uint32_t rekey_step_max;
+} receiver_telemetry_t;
+
+static receiver_telemetry_t telemetry;
+static bool have_telemetry = false;
+
+static const sim_matrix_t left_matrix = {
+    { L_R01, L_R02, L_R03, L_R04, L_R05 },
+    { L_C01, L_C02, L_C03, L_C04, L_C05, L_C06, L_C07 }
+};
+
+static const sim_matrix_t right_matrix = {
+    { R_R01, R_R02, R_R03, R_R04, R_R05 },
+    { R_C01, R_C02, R_C03, R_C04, R_C05, R_C06, R_C07 }
+};
+
+static uint32_t random_between(uint32_t low, uint32_t high) {
+    return low + (uint32_t) (sim_random() % (high - low + 1));
+}
+
+static key_state_t* key_at(int half, int row, int column) {
+    return &keys[(half * SIM_MATRIX_ROWS + row) * SIM_MATRIX_COLUMNS + column];
+}
+
+static void set_key(int half, int row, int column, bool pressed) {
+    key_state_t* key = key_at(half, row, column);
+
+    if (key->pending) {
+        ++stats.superseded;
+    }
+    key->pressed = pressed;
+    key->pending = true;
+    key->changed = sim_now();
+    ++stats.changes;
+    sim_set_key(halves[half], row, column, pressed);
+}
+
+/*
+    Switch bounce: the contact flips back and forth a few times at random
+    within bounce_time of the change before it settles.
+*/
+static void bounce(void* user) {
+    int index = (int) (intptr_t) user / 2;
+    bool pressed = (intptr_t) user & 1;
+
+    sim_set_key(halves[index / (SIM_MATRIX_ROWS * SIM_MATRIX_COLUMNS)],
+                (index / SIM_MATRIX_COLUMNS) % SIM_MATRIX_ROWS,
+                index % SIM_MATRIX_COLUMNS,
+                pressed);
+}
+
+static void schedule_bounces(int index, bool pressed) {
+    sim_time_t when = sim_now();
+
+    if (bounce_time == 0) {
+        return;
+    }
+    for (int flip = 0; flip < BOUNCES; ++flip) {
+        sim_time_t open = when + 1 + sim_random() % (bounce_time / (2 * BOUNCES));
+        when = open + 1 + sim_random() % (bounce_time / (2 * BOUNCES));
+        sim_schedule(open, bounce, (void*) (intptr_t) (index * 2 + !pressed));
+        sim_schedule(when, bounce, (void*) (intptr_t) (index * 2 + pressed));
+    }
+}
+
+/*
+    Typist.
+*/
+static void release_key(void* user) {
+    int index = (int) (intptr_t) user;
+    int half = index / (SIM_MATRIX_ROWS * SIM_MATRIX_COLUMNS);
+    int row = (index / SIM_MATRIX_COLUMNS) % SIM_MATRIX_ROWS;
+    int column = index % SIM_MATRIX_COLUMNS;
+
+    set_key(half, row, column, false);
+    schedule_bounces(index, false);
+}
+
+static void stroke(void* user) {
+    if (sim_now() >= typing_end) {
+        return;
+    }
+
+    int index = (int) random_between(0, KEY_COUNT - 1);
+
+    // Rollover onto a key that's still held just extends the hold.
+    if (!keys[index].pressed) {
+        set_key(index / (SIM_MATRIX_ROWS * SIM_MATRIX_COLUMNS),
+                (index / SIM_MATRIX_COLUMNS) % SIM_MATRIX_ROWS,
+                index % SIM_MATRIX_COLUMNS,
+                true);
+        schedule_bounces(index, true);
+        sim_schedule(sim_now() + SIM_MS(random_between(HOLD_MIN_MS, hold_max_ms)), release_key, (void*) (intptr_t) index);
+    }
+    sim_schedule(sim_now() + SIM_MS(random_between(GAP_MIN_MS, GAP_MAX_MS)), stroke, NULL);
+}
+
+/*
+    QMK side of the UART link.
+*/
+static void qmk_poll(void* user) {
+    if (sim_now() >= polling_end) {
+        sim_uart_receive(receiver, 'l');
+        sim_uart_receive(receiver, 't');
+        return;
+    }
+    sim_uart_receive(receiver, 's');
+    sim_schedule(sim_now() + QMK_POLL_INTERVAL, qmk_poll, NULL);
+}
+
+static void restart_device(void* user) {
+    sim_restart_device(user);
+}
+
+static void add_sample(sample_set_t* set, sim_time_t latency) {
+    if (set->count < MAX_SAMPLES) {
+        set->values[set->count++] = (uint32_t) (latency / 1000);
+    }
+}
+
+// Byte 2r holds row r of the left half and byte 2r+1 row r of the right;
+// bit c is column c.
+static void decode_frame(sim_time_t when) {
+    ++stats.frames;
+    for (int half = 0; half < HALVES; ++half) {
+        for (int row = 0; row < SIM_MATRIX_ROWS; ++row) {
+            uint8_t bits = frame[row * 2 + half];
+            for (int column = 0; column < SIM_MATRIX_COLUMNS; ++column) {
+                key_state_t* key = key_at(half, row, column);
+                bool pressed = (bits >> column) & 1;
+                if (key->pending && pressed == key->pressed) {
+                    key->pending = false;
+                    ++stats.reported;
+                    add_sample(&samples, when - key->changed);
+                    add_sample(pressed ? &press_samples : &release_samples, when - key->changed);
+                } else if (!key->pending && pressed != key->pressed && !key->spurious) {
+                    ++stats.spurious;
+                }
+                key->spurious = !key->pending && pressed != key->pressed;
+            }
+        }
+    }
+}
+
+// Start byte, command, body length, the body, then an XOR of the rest.
+static void decode_report(void) {
+    uint8_t command = frame[1];
+    size_t length = frame[2];
+    uint8_t checksum = 0;
+
+    for (size_t idx = 0; idx < 3 + length + 1; ++idx) {
+        checksum ^= frame[idx];
+    }
+    if (checksum != 0) {
+        ++stats.bad_frames;
+    } else if (command == 'l' && length == sizeof(firmware_latency)) {
+        memcpy(firmware_latency, frame + 3, sizeof(firmware_latency));
+        have_firmware_latency = true;
+    } else if (command == 't' && length == sizeof(telemetry)) {
+        memcpy(&telemetry, frame + 3, sizeof(telemetry));
+        have_telemetry = true;
+    } else {
+        ++stats.bad_frames;
+    }
+}
+
+static void uart_sink(sim_device_t* device, const uint8_t* data, size_t length, sim_time_t done, void* user) {
+    for (size_t idx = 0; idx < length; ++idx) {
+        frame[frame_length++] = data[idx];
+        // Key frames never start with the top bit set.
+        if (frame[0] == REPORT_START) {
+            if (frame_length > 3 && frame_length == 3 + frame[2] + 1) {
+                decode_report();
+                frame_length = 0;
+            }
+        } else if (frame_length == FRAME_LENGTH) {
+            if (frame[FRAME_LENGTH - 1] == FRAME_END) {
+                decode_frame(done);
+            } else {
+                ++stats.bad_frames;
+            }
+            frame_length = 0;
+        }
+    }
+}
+
+/*
+    Reporting.
+*/
+static int compare_samples(const void* a, const void* b) {
+    uint32_t left = *(const uint32_t*) a;
+    uint32_t right = *(const uint32_t*) b;
+    return (left > right) - (left < right);
+}
+
+static uint32_t percentile(const sample_set_t* set, uint32_t percent) {
+    if (set->count == 0) {
+        return 0;
+    }
+    return set->values[((uint64_t) (set->count - 1) * percent) / 100];
+}
+
+static double mean(const sample_set_t* set) {
+    uint64_t total = 0;
+    for (uint32_t idx = 0; idx < set->count; ++idx) {
+        total += set->values[idx];
+    }
+    return set->count ? (double) total / set->count : 0.0;
+}
+
+static void print_latency_text(const char* name, const sample_set_t* set) {
+    printf("%s us: mean %.0f, p50 %u, p90 %u, p99 %u, max %u\n", name,
+        mean(set), percentile(set, 50), percentile(set, 90), percentile(set, 99), percentile(set, 100));
+}
+
+static void print_latency_json(const char* name, const sample_set_t* set) {
+    printf("  \"%s\": {\"mean\": %.0f, \"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u},\n", name,
+        mean(set), percentile(set, 50), percentile(set, 90), percentile(set, 99), percentile(set, 100));
+}
+
+static double parse_percent(const char* text) {
+    return strtod(text, NULL) / 100.0;
+}
+
+// enter,exit,loss as percentages per attempt.
+static bool parse_burst(const char* text, sim_loss_t* loss) {
+    double enter, exit, burst_loss;
+    if (sscanf(text, "%lf,%lf,%lf", &enter, &exit, &burst_loss) != 3) {
+        return false;
+    }
+    loss->burst_enter = enter / 100.0;
+    loss->burst_exit = exit / 100.0;
+    loss->burst_loss = burst_loss / 100.0;
+    return true;
+}
+
+static uint32_t histogram_mean(const mitosis_latency_histogram_t* histogram) {
+    return histogram->count ? histogram->sum_us / histogram->count : 0;
+}
+
+static void report_text(uint32_t seconds, uint64_t seed) {
+    printf("simulated %u s, seed %llu\n", seconds, (unsigned long long) seed);
+    printf("key changes: %u reported, %u superseded, %u missed, %u spurious, %u total\n",
+        stats.reported, stats.superseded, stats.missed, stats.spurious, stats.changes);
+    printf("uart frames: %u (%u malformed)\n", stats.frames, stats.bad_frames);
+    print_latency_text("latency", &samples);
+    print_latency_text("press latency", &press_samples);
+    print_latency_text("release latency", &release_samples);
+    for (size_t idx = 0; idx < sim_device_count(); ++idx) {
+        sim_device_t* device = sim_device_at(idx);
+        const sim_radio_stats_t* radio = sim_radio_stats(device);
+        printf("%s radio: %u queued, %u attempts (max %u), %u sent, %u failed, %u lost, %u acks lost, "
+            "%u ack payloads, %u received, %u duplicates, %u rx flushed, %u tx flushed\n",
+            sim_device_name(device), radio->packets_queued, radio->tx_attempts, radio->max_tx_attempts,
+            radio->tx_success, radio->tx_failed, radio->packets_lost, radio->acks_lost,
+            radio->ack_payloads_received, radio->packets_received, radio->duplicates,
+            radio->rx_flushed, radio->tx_flushed);
+    }
+    for (size_t idx = 0; idx < sim_device_count(); ++idx) {
+        sim_device_t* device = sim_device_at(idx);
+        sim_device_stats_t cpu;
+        sim_device_stats(device, &cpu);
+        printf("%s cpu: %u wakeups, %llu us awake\n",
+            sim_device_name(device), cpu.wakeups, (unsigned long long) (cpu.awake / 1000));
+    }
+    if (!have_firmware_latency) {
+        printf("firmware latency: no report\n");
+    }
+    for (int idx = 0; have_firmware_latency && idx < LATENCY_HISTOGRAMS; ++idx) {
+        const mitosis_latency_histogram_t* histogram = &firmware_latency[idx];
+        printf("%s latency us: %u samples, mean %u, max %u, buckets",
+            latency_names[idx], histogram->count, histogram_mean(histogram), histogram->max_us);
+        for (uint8_t bucket = 0; bucket < MITOSIS_LATENCY_BUCKETS; ++bucket) {
+            if (histogram->buckets[bucket] != 0) {
+                printf(" %u:%u", mitosis_latency_bucket_floor(bucket), histogram->buckets[bucket]);
+            }
+        }
+        printf("\n");
+    }
+    if (!have_telemetry) {
+        printf("receiver telemetry: no report\n");
+        return;
+    }
+    for (int half = 0; half < HALVES; ++half) {
+        const keyboard_telemetry_t* keyboard = &telemetry.halves[half];
+        printf("%s telemetry: %u packets, %u cmac failures, %u decrypt failures, %u skipped, %u replayed, key %u (next %u, %s), rekey state %u\n",
+            half ? "right" : "left", keyboard->packets, keyboard->cmac_fail, keyboard->decrypt_fail, keyboard->skipped, keyboard->replayed,
+            keyboard->key_id, keyboard->new_key_id, keyboard->key_id_confirmed ? "confirmed" : "unconfirmed",
+            keyboard->rekey_state);
+        printf("%s link: %u telemetry packets, %u sent, %u failed, %u attempts (max %u), rekey %u ok %u bad mac %u bad seed, "
+            "%u crypto failures, %u overflows (high water %u)\n",
+            half ? "right" : "left", keyboard->telemetry_packets,
+            keyboard->link[mitosis_telemetry_tx_count], keyboard->link[mitosis_telemetry_tx_fail],
+            keyboard->link[mitosis_telemetry_rtx_count], keyboard->link[mitosis_telemetry_max_rtx],
+            keyboard->link[mitosis_telemetry_rekey_cmac_success], keyboard->link[mitosis_telemetry_rekey_cmac_failure],
+            keyboard->link[mitosis_telemetry_rekey_decrypt_failure], keyboard->link[mitosis_telemetry_crypto_failure],
+            keyboard->link[mitosis_telemetry_report_overflows], keyboard->link[mitosis_telemetry_report_high_water]);
+    }
+    printf("receiver telemetry: %u rx overflows, rx high water %u, %u ecb blocks, %u ecb wakeups, %u rekey steps (max %uus)\n",
+        telemetry.rx_overflows, telemetry.rx_high_water, telemetry.ecb_blocks, telemetry.ecb_wakeups,
+        telemetry.rekey_steps, telemetry.rekey_step_max);
+}
+
+static void report_json(uint32_t seconds, uint64_t seed) {
+    printf("{\n");
+    printf("  \"seconds\": %u, \"seed\": %llu,\n", seconds, (unsigned long long) seed);
+    printf("  \"changes\": %u, \"reported\": %u, \"superseded\": %u, \"missed\": %u, \"spurious\": %u,\n",
+        stats.changes, stats.reported, stats.superseded, stats.missed, stats.spurious);
+    printf("  \"frames\": %u, \"bad_frames\": %u,\n", stats.frames, stats.bad_frames);
+    print_latency_json("latency_us", &samples);
+    print_latency_json("press_latency_us", &press_samples);
+    print_latency_json("release_latency_us", &release_samples);
+    printf("  \"radio\": [\n");
+    for (size_t idx = 0; idx < sim_device_count(); ++idx) {
+        sim_device_t* device = sim_device_at(idx);
+        const sim_radio_stats_t* radio = sim_radio_stats(device);
+        printf("    {\"device\": \"%s\", \"queued\": %u, \"attempts\": %u, \"max_attempts\": %u, "
+            "\"sent\": %u, \"failed\": %u, \"lost\": %u, \"acks_lost\": %u, \"ack_payloads\": %u, "
+            "\"received\": %u, \"duplicates\": %u, \"rx_flushed\": %u, \"tx_flushed\": %u}%s\n",
+            sim_device_name(device), radio->packets_queued, radio->tx_attempts, radio->max_tx_attempts,
+            radio->tx_success, radio->tx_failed, radio->packets_lost, radio->acks_lost,
+            radio->ack_payloads_received, radio->packets_received, radio->duplicates,
+            radio->rx_flushed, radio->tx_flushed,
+            idx + 1 < sim_device_count() ? "," : "");
+    }
+    printf("  ],\n");
+    printf("  \"cpu\": [\n");
+    for (size_t idx = 0; idx < sim_device_count(); ++idx) {
+        sim_device_t* device = sim_device_at(idx);
+        sim_device_stats_t cpu;
+        sim_device_stats(device, &cpu);
+        printf("    {\"device\": \"%s\", \"wakeups\": %u, \"awake_us\": %llu}%s\n",
+            sim_device_name(device), cpu.wakeups, (unsigned long long) (cpu.awake / 1000),
+            idx + 1 < sim_device_count() ? "," : "");
+    }
+    printf("  ],\n");
+    printf("  \"firmware_latency_us\": [");
+    for (int idx = 0; have_firmware_latency && idx < LATENCY_HISTOGRAMS; ++idx) {
+        const mitosis_latency_histogram_t* histogram = &firmware_latency[idx];
+        printf("%s\n    {\"stage\": \"%s\", \"count\": %u, \"mean\": %u, \"max\": %u, \"buckets\": [",
+            idx ? "," : "", latency_names[idx], histogram->count, histogram_mean(histogram), histogram->max_us);
+        for (uint8_t bucket = 0; bucket < MITOSIS_LATENCY_BUCKETS; ++bucket) {
+            printf("%s%u", bucket ? ", " : "", histogram->buckets[bucket]);
+        }
+        printf("]}");
+    }
+    printf("\n  ],\n");
+    printf("  \"telemetry\": ");
+    if (have_telemetry) {
+        printf("{\"halves\": [");
+        for (int half = 0; half < HALVES; ++half) {
+            const keyboard_telemetry_t* keyboard = &telemetry.halves[half];
+            printf("%s\n    {\"packets\": %u, \"cmac_fail\": %u, \"decrypt_fail\": %u, \"skipped\": %u, \"replayed\": %u, "
+                "\"key_id\": %u, \"new_key_id\": %u, \"key_id_confirmed\": %s, \"rekey_state\": %u, "
+                "\"telemetry_packets\": %u, \"link\": [",
+                half ? "," : "", keyboard->packets, keyboard->cmac_fail, keyboard->decrypt_fail, keyboard->skipped, keyboard->replayed,
+                keyboard->key_id, keyboard->new_key_id, keyboard->key_id_confirmed ? "true" : "false",
+                keyboard->rekey_state, keyboard->telemetry_packets);
+            for (int value = 0; value < MITOSIS_TELEMETRY_VALUES; ++value) {
+                printf("%s%u", value ? ", " : "", keyboard->link[value]);
+            }
+            printf("]}");
+        }
+        printf("],\n    \"rx_overflows\": %u, \"rx_high_water\": %u, \"ecb_blocks\": %u, \"ecb_wakeups\": %u, "
+            "\"rekey_steps\": %u, \"rekey_step_max_us\": %u}\n",
+            telemetry.rx_overflows, telemetry.rx_high_water, telemetry.ecb_blocks, telemetry.ecb_wakeups,
+            telemetry.rekey_steps, telemetry.rekey_step_max);
+    } else {
+        printf("null\n");
+    }
+    printf("}\n");
+}
+
+static void usage(const char* program) {
+    printf("usage: %s [--json] [-t seconds] [-s seed]\n"
+           "       [-l loss%%] [--ack-loss loss%%] [--burst enter%%,exit%%,loss%%]\n"
+           "       [--attempt-us us] [--jitter-us us] [--max-attempts n]\n"
+           "       [--bounce-us us] [--debounce eager|deferred] [--hold-ms ms]\n"
+           "       [--restart-receiver ms] [--restart-left ms] [--coalesce on|off]\n", program);
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    uint32_t seconds = DEFAULT_SECONDS;
+    uint64_t seed = 1;
+    bool json = false;
+    bool deferred = false;
+    sim_time_t restart_time = 0;
+    sim_time_t restart_left_time = 0;
+    bool coalesce = true;
+    sim_channel_t channel;
+
+    sim_radio_default_channel(&channel);
+    for (int idx = 1; idx < argc; ++idx) {
+        if (strcmp(argv[idx], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[idx], "-t") == 0 && idx + 1 < argc) {
+            seconds = (uint32_t) strtoul(argv[++idx], NULL, 0);
+        } else if (strcmp(argv[idx], "-s") == 0 && idx + 1 < argc) {
+            seed = strtoull(argv[++idx], NULL, 0);
+        } else if (strcmp(argv[idx], "-l") == 0 && idx + 1 < argc) {
+            channel.data.loss = parse_percent(argv[++idx]);
+            channel.ack.loss = channel.data.loss;
+        } else if (strcmp(argv[idx], "--ack-loss") == 0 && idx + 1 < argc) {
+            channel.ack.loss = parse_percent(argv[++idx]);
+        } else if (strcmp(argv[idx], "--burst") == 0 && idx + 1 < argc) {
+            if (!parse_burst(argv[++idx], &channel.data)) {
+                usage(argv[0]);
+            }
+            channel.ack.burst_enter = channel.data.burst_enter;
+            channel.ack.burst_exit = channel.data.burst_exit;
+            channel.ack.burst_loss = channel.data.burst_loss;
+        } else if (strcmp(argv[idx], "--attempt-us") == 0 && idx + 1 < argc) {
+            channel.attempt_time = SIM_US(strtoul(argv[++idx], NULL, 0));
+        } else if (strcmp(argv[idx], "--jitter-us") == 0 && idx + 1 < argc) {
+            channel.attempt_jitter = SIM_US(strtoul(argv[++idx], NULL, 0));
+        } else if (strcmp(argv[idx], "--max-attempts") == 0 && idx + 1 < argc) {
+            channel.max_tx_attempts = (uint16_t) strtoul(argv[++idx], NULL, 0);
+        } else if (strcmp(argv[idx], "--bounce-us") == 0 && idx + 1 < argc) {
+            bounce_time = SIM_US(strtoul(argv[++idx], NULL, 0));
+        } else if (strcmp(argv[idx], "--hold-ms") == 0 && idx + 1 < argc) {
+            hold_max_ms = (uint32_t) strtoul(argv[++idx], NULL, 0);
+            if (hold_max_ms < HOLD_MIN_MS) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[idx], "--restart-receiver") == 0 && idx + 1 < argc) {
+            restart_time = SIM_MS(strtoul(argv[++idx], NULL, 0));
+            if (restart_time == 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[idx], "--restart-left") == 0 && idx + 1 < argc) {
+            restart_left_time = SIM_MS(strtoul(argv[++idx], NULL, 0));
+            if (restart_left_time == 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[idx], "--debounce") == 0 && idx + 1 < argc) {
+            ++idx;
+            if (strcmp(argv[idx], "deferred") == 0) {
+                deferred = true;
+            } else if (strcmp(argv[idx], "eager") != 0) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[idx], "--coalesce") == 0 && idx + 1 < argc) {
+            ++idx;
+            if (strcmp(argv[idx], "off") == 0) {
+                coalesce = false;
+            } else if (strcmp(argv[idx], "on") != 0) {
+                usage(argv[0]);
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    sim_init(seed);
+    channel.seed = seed;
+    sim_radio_set_channel(&channel);
+    receiver = sim_add_device(coalesce ? &sim_firmware_receiver : &sim_firmware_receiver_uncoalesced);
+    halves[0] = sim_add_device(deferred ? &sim_firmware_keyboard_left_deferred : &sim_firmware_keyboard_left);
+    halves[1] = sim_add_device(deferred ? &sim_firmware_keyboard_right_deferred : &sim_firmware_keyboard_right);
+    sim_attach_matrix(halves[0], &left_matrix);
+    sim_attach_matrix(halves[1], &right_matrix);
+    sim_set_uart_sink(receiver, uart_sink, NULL);
+
+    // Give everything a moment to boot before typing starts.
+    sim_schedule(SIM_MS(1), qmk_poll, NULL);
+    sim_schedule(SIM_MS(100), stroke, NULL);
+    if (restart_time != 0) {
+        sim_schedule(restart_time, restart_device, receiver);
+    }
+    if (restart_left_time != 0) {
+        sim_schedule(restart_left_time, restart_device, halves[0]);
+    }
+    polling_end = SIM_MS((uint64_t) seconds * 1000);
+    typing_end = polling_end - SETTLE_TIME;
+    sim_run_until(polling_end + REPORT_TIME);
+
+    for (int idx = 0; idx < KEY_COUNT; ++idx) {
+        if (keys[idx].pending) {
+            ++stats.missed;
+        }
+    }
+    qsort(samples.values, samples.count, sizeof(samples.values[0]), compare_samples);
+    qsort(press_samples.values, press_samples.count, sizeof(press_samples.values[0]), compare_samples);
+    qsort(release_samples.values, release_samples.count, sizeof(release_samples.values[0]), compare_samples);
+
+    if (json) {
+        report_json(seconds, seed);
+    } else {
+        report_text(seconds, seed);
+    }
+    return 0;
+}
@@ -0,0 +1,554 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nrf.h"
+#include "nrf_gzll.h"
+#include "sim.h"
+
+#define CALLBACK_QUEUE_SIZE 16
+
+typedef struct _packet_t {
+    uint8_t data[NRF_GZLL_CONST_MAX_PAYLOAD_LENGTH];
+    uint32_t length;
+} packet_t;
+
+typedef struct _fifo_t {
+    packet_t packets[NRF_GZLL_CONST_FIFO_LENGTH];
+    uint32_t head;
+    uint32_t count;
+} fifo_t;
+
+typedef enum {
+    callback_tx_success,
+    callback_tx_failed,
+    callback_rx_data_ready
+} callback_type_t;
+
+typedef struct _callback_t {
+    callback_type_t type;
+    uint32_t pipe;
+    bool payload_received_in_ack;
+    uint16_t num_tx_attempts;
+} callback_t;
+
+struct _sim_radio_t {
+    sim_device_t* device;
+    nrf_gzll_mode_t mode;
+    bool enabled;
+    uint32_t base_address_0;
+    uint32_t base_address_1;
+    uint16_t max_tx_attempts;
+    fifo_t tx_fifo[NRF_GZLL_CONST_PIPE_COUNT];
+    fifo_t rx_fifo[NRF_GZLL_CONST_PIPE_COUNT];
+
+    // Device mode sends one packet at a time.
+    bool transmitting;
+    uint32_t tx_pipe;
+    uint16_t tx_attempts;
+    uint32_t tx_id;
+    sim_time_t attempt_due;
+    // Burst state of the link to the host and back.
+    bool data_burst;
+    bool ack_burst;
+
+    // Host mode drops retransmissions of the last packet on each pipe.
+    const sim_radio_t* last_sender[NRF_GZLL_CONST_PIPE_COUNT];
+    uint32_t last_id[NRF_GZLL_CONST_PIPE_COUNT];
+
+    callback_t callbacks[CALLBACK_QUEUE_SIZE];
+    uint32_t callback_head;
+    uint32_t callback_count;
+
+    sim_radio_stats_t stats;
+};
+
+nrf_gzll_error_code_t nrf_gzll_error_code = NRF_GZLL_ERROR_CODE_NO_ERROR;
+
+static sim_channel_t channel =
+{
+    .attempt_time = SIM_GZLL_ATTEMPT_TIME,
+    .seed = 1,
+};
+static uint64_t channel_random_state = 1;
+
+static sim_radio_t* current_radio(void)
+{
+    return sim_device_radio(sim_current());
+}
+
+static bool fail(nrf_gzll_error_code_t error)
+{
+    nrf_gzll_error_code = error;
+    return false;
+}
+
+/*
+    FIFO helpers.
+*/
+static bool fifo_push(fifo_t* fifo, const uint8_t* data, uint32_t length)
+{
+    if (fifo->count == NRF_GZLL_CONST_FIFO_LENGTH)
+    {
+        return false;
+    }
+    packet_t* packet = &fifo->packets[(fifo->head + fifo->count++) % NRF_GZLL_CONST_FIFO_LENGTH];
+    memcpy(packet->data, data, length);
+    packet->length = length;
+    return true;
+}
+
+static packet_t* fifo_front(fifo_t* fifo)
+{
+    return fifo->count ? &fifo->packets[fifo->head] : NULL;
+}
+
+static void fifo_pop(fifo_t* fifo)
+{
+    fifo->head = (fifo->head + 1) % NRF_GZLL_CONST_FIFO_LENGTH;
+    --fifo->count;
+}
+
+/*
+    Channel model.
+*/
+void sim_radio_default_channel(sim_channel_t* config)
+{
+    memset(config, 0, sizeof(*config));
+    config->attempt_time = SIM_GZLL_ATTEMPT_TIME;
+    config->seed = 1;
+}
+
+void sim_radio_set_channel(const sim_channel_t* config)
+{
+    channel = *config;
+    channel_random_state = config->seed ? config->seed : 1;
+}
+
+// xorshift64*, separate from sim_random().
+static uint64_t channel_random(void)
+{
+    channel_random_state ^= channel_random_state >> 12;
+    channel_random_state ^= channel_random_state << 25;
+    channel_random_state ^= channel_random_state >> 27;
+    return channel_random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static double channel_uniform(void)
+{
+    return (channel_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool attempt_lost(const sim_loss_t* loss, bool* burst)
+{
+    if (*burst)
+    {
+        if (channel_uniform() < loss->burst_exit)
+        {
+            *burst = false;
+        }
+    }
+    else if (channel_uniform() < loss->burst_enter)
+    {
+        *burst = true;
+    }
+    return channel_uniform() < (*burst ? loss->burst_loss : loss->loss);
+}
+
+static uint16_t max_tx_attempts(const sim_radio_t* radio)
+{
+    return channel.max_tx_attempts ? channel.max_tx_attempts : radio->max_tx_attempts;
+}
+
+/*
+    Link simulation.
+*/
+sim_radio_t* sim_radio_create(sim_device_t* device)
+{
+    sim_radio_t* radio = calloc(1, sizeof(*radio));
+    if (radio == NULL)
+    {
+        abort();
+    }
+    radio->device = device;
+    radio->mode = NRF_GZLL_MODE_SUSPEND;
+    radio->max_tx_attempts = NRF_GZLL_DEFAULT_MAX_TX_ATTEMPTS;
+    return radio;
+}
+
+void sim_radio_reset(sim_radio_t* radio)
+{
+    sim_device_t* device = radio->device;
+    sim_radio_stats_t stats = radio->stats;
+    // Keep numbering packets where it left off, so hosts don't take the
+    // first ones after the restart for retransmissions.
+    uint32_t tx_id = radio->tx_id;
+
+    memset(radio, 0, sizeof(*radio));
+    radio->device = device;
+    radio->mode = NRF_GZLL_MODE_SUSPEND;
+    radio->max_tx_attempts = NRF_GZLL_DEFAULT_MAX_TX_ATTEMPTS;
+    radio->tx_id = tx_id;
+    radio->stats = stats;
+}
+
+const sim_radio_stats_t* sim_radio_stats(sim_device_t* device)
+{
+    return &sim_device_radio(device)->stats;
+}
+
+static uint32_t pipe_address(const sim_radio_t* radio, uint32_t pipe)
+{
+    return pipe == 0 ? radio->base_address_0 : radio->base_address_1;
+}
+
+static sim_radio_t* find_host(const sim_radio_t* radio, uint32_t pipe)
+{
+    for (size_t idx = 0; idx < sim_device_count(); ++idx)
+    {
+        sim_radio_t* host = sim_device_radio(sim_device_at(idx));
+        if (host->mode == NRF_GZLL_MODE_HOST && host->enabled &&
+            pipe_address(host, pipe) == pipe_address(radio, pipe))
+        {
+            return host;
+        }
+    }
+    return NULL;
+}
+
+static void queue_callback(sim_radio_t* radio, const callback_t* callback)
+{
+    if (callback->type != callback_rx_data_ready && callback->num_tx_attempts > radio->stats.max_tx_attempts)
+    {
+        radio->stats.max_tx_attempts = callback->num_tx_attempts;
+    }
+    if (radio->callback_count == CALLBACK_QUEUE_SIZE)
+    {
+        // Can only happen if the firmware sits with the radio IRQ masked.
+        abort();
+    }
+    radio->callbacks[(radio->callback_head + radio->callback_count++) % CALLBACK_QUEUE_SIZE] = *callback;
+    sim_pend_irq(radio->device, RADIO_IRQn);
+}
+
+static void start_attempt(sim_radio_t* radio);
+static void attempt_done(void* user);
+
+static void schedule_attempt(sim_radio_t* radio)
+{
+    radio->attempt_due = sim_now() + channel.attempt_time;
+    if (channel.attempt_jitter)
+    {
+        radio->attempt_due += channel_random() % channel.attempt_jitter;
+    }
+    sim_schedule(radio->attempt_due, attempt_done, radio);
+}
+
+static void attempt_done(void* user)
+{
+    sim_radio_t* radio = user;
+    // Ignore attempts left over from a flushed or disabled transmission.
+    if (!radio->transmitting || sim_now() != radio->attempt_due)
+    {
+        return;
+    }
+
+    uint32_t pipe = radio->tx_pipe;
+    packet_t* packet = fifo_front(&radio->tx_fifo[pipe]);
+    sim_radio_t* host = find_host(radio, pipe);
+    packet_t* ack = NULL;
+    bool acked = false;
+    ++radio->tx_attempts;
+    ++radio->stats.tx_attempts;
+
+    if (host == NULL || attempt_lost(&channel.data, &radio->data_burst))
+    {
+        ++radio->stats.packets_lost;
+    }
+    else if (host->last_sender[pipe] == radio && host->last_id[pipe] == radio->tx_id)
+    {
+        // Already have it; the ACK must have been lost. ACK it again.
+        ++host->stats.duplicates;
+        ack = fifo_front(&host->tx_fifo[pipe]);
+        acked = true;
+    }
+    else if (host->rx_fifo[pipe].count < NRF_GZLL_CONST_FIFO_LENGTH)
+    {
+        // The host only acknowledges a packet it has room to keep.
+        ack = fifo_front(&host->tx_fifo[pipe]);
+        callback_t rx = { callback_rx_data_ready, pipe, ack != NULL, 0 };
+
+        fifo_push(&host->rx_fifo[pipe], packet->data, packet->length);
+        host->last_sender[pipe] = radio;
+        host->last_id[pipe] = radio->tx_id;
+        ++host->stats.packets_received;
+        queue_callback(host, &rx);
+        acked = true;
+    }
+
+    if (acked && attempt_lost(&channel.ack, &radio->ack_burst))
+    {
+        // The host keeps its ACK payload until an ACK carrying it arrives.
+        ++radio->stats.acks_lost;
+        acked = false;
+    }
+
+    if (acked)
+    {
+        callback_t tx = { callback_tx_success, pipe, false, radio->tx_attempts };
+
+        if (ack != NULL && fifo_push(&radio->rx_fifo[pipe], ack->data, ack->length))
+        {
+            fifo_pop(&host->tx_fifo[pipe]);
+            tx.payload_received_in_ack = true;
+            ++radio->stats.ack_payloads_received;
+        }
+        fifo_pop(&radio->tx_fifo[pipe]);
+        ++radio->stats.tx_success;
+        radio->transmitting = false;
+        queue_callback(radio, &tx);
+    }
+    else if (max_tx_attempts(radio) != 0 && radio->tx_attempts >= max_tx_attempts(radio))
+    {
+        callback_t tx = { callback_tx_failed, pipe, false, radio->tx_attempts };
+
+        fifo_pop(&radio->tx_fifo[pipe]);
+        ++radio->stats.tx_failed;
+        radio->transmitting = false;
+        queue_callback(radio, &tx);
+    }
+    else
+    {
+        schedule_attempt(radio);
+        return;
+    }
+    start_attempt(radio);
+}
+
+static void start_attempt(sim_radio_t* radio)
+{
+    if (radio->transmitting || !radio->enabled || radio->mode != NRF_GZLL_MODE_DEVICE)
+    {
+        return;
+    }
+    for (uint32_t pipe = 0; pipe < NRF_GZLL_CONST_PIPE_COUNT; ++pipe)
+    {
+        if (radio->tx_fifo[pipe].count > 0)
+        {
+            radio->transmitting = true;
+            radio->tx_pipe = pipe;
+            radio->tx_attempts = 0;
+            ++radio->tx_id;
+            schedule_attempt(radio);
+            return;
+        }
+    }
+}
+
+void sim_radio_irq(sim_device_t* device)
+{
+    sim_radio_t* radio = sim_device_radio(device);
+    const sim_firmware_t* firmware = sim_device_firmware(device);
+
+    while (radio->callback_count > 0)
+    {
+        callback_t callback = radio->callbacks[radio->callback_head];
+        radio->callback_head = (radio->callback_head + 1) % CALLBACK_QUEUE_SIZE;
+        --radio->callback_count;
+
+        switch (callback.type)
+        {
+            case callback_tx_success:
+            {
+                nrf_gzll_device_tx_info_t info = { callback.payload_received_in_ack, callback.num_tx_attempts, 0, 0 };
+                firmware->gzll_device_tx_success(callback.pipe, info);
+                break;
+            }
+            case callback_tx_failed:
+            {
+                nrf_gzll_device_tx_info_t info = { callback.payload_received_in_ack, callback.num_tx_attempts, 0, 0 };
+                firmware->gzll_device_tx_failed(callback.pipe, info);
+                break;
+            }
+            case callback_rx_data_ready:
+            {
+                nrf_gzll_host_rx_info_t info = { callback.payload_received_in_ack, 0 };
+                firmware->gzll_host_rx_data_ready(callback.pipe, info);
+                break;
+            }
+        }
+    }
+}
+
+/*
+    Gazell API, called from firmware.
+*/
+bool nrf_gzll_init(nrf_gzll_mode_t mode)
+{
+    sim_radio_t* radio = current_radio();
+
+    sim_charge(SIM_ACCESS_COST);
+    if (radio->enabled)
+    {
+        return fail(NRF_GZLL_ERROR_CODE_ATTEMPTED_TO_CONFIGURE_WHEN_ENABLED);
+    }
+    radio->mode = mode;
+    // Gazell runs the radio and its callbacks at the highest priority.
+    NVIC_SetPriority(RADIO_IRQn, 0);
+    NVIC_EnableIRQ(RADIO_IRQn);
+    return true;
+}
+
+bool nrf_gzll_enable(void)
+{
+    sim_radio_t* radio = current_radio();
+
+    sim_charge(SIM_ACCESS_COST);
+    radio->enabled = true;
+    start_attempt(radio);
+    return true;
+}
+
+void nrf_gzll_disable(void)
+{
+    sim_radio_t* radio = current_radio();
+
+    sim_charge(SIM_ACCESS_COST);
+    radio->enabled = false;
+    radio->transmitting = false;
+}
+
+bool nrf_gzll_is_enabled(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    return current_radio()->enabled;
+}
+
+bool nrf_gzll_set_max_tx_attempts(uint16_t max_tx_attempts)
+{
+    sim_charge(SIM_ACCESS_COST);
+    current_radio()->max_tx_attempts = max_tx_attempts;
+    return true;
+}
+
+bool nrf_gzll_set_base_address_0(uint32_t base_address)
+{
+    sim_radio_t* radio = current_radio();
+
+    sim_charge(SIM_ACCESS_COST);
+    if (radio->enabled)
+    {
+        return fail(NRF_GZLL_ERROR_CODE_ATTEMPTED_TO_CONFIGURE_WHEN_ENABLED);
+    }
+    radio->base_address_0 = base_address;
+    return true;
+}
+
+bool nrf_gzll_set_base_address_1(uint32_t base_address)
+{
+    sim_radio_t* radio = current_radio();
+
+    sim_charge(SIM_ACCESS_COST);
+    if (radio->enabled)
+    {
+        return fail(NRF_GZLL_ERROR_CODE_ATTEMPTED_TO_CONFIGURE_WHEN_ENABLED);
+    }
+    radio->base_address_1 = base_address;
+    return true;
+}
+
+bool nrf_gzll_add_packet_to_tx_fifo(uint32_t pipe, uint8_t * p_payload, uint32_t length)
+{
+    sim_radio_t* radio = current_radio();
+
+    sim_charge(SIM_ACCESS_COST);
+    if (pipe >= NRF_GZLL_CONST_PIPE_COUNT)
+    {
+        return fail(NRF_GZLL_ERROR_CODE_INVALID_PIPE);
+    }
+    if (length > NRF_GZLL_CONST_MAX_PAYLOAD_LENGTH || (length == 0 && radio->mode == NRF_GZLL_MODE_DEVICE))
+    {
+        return fail(NRF_GZLL_ERROR_CODE_INVALID_PAYLOAD_LENGTH);
+    }
+    if (!fifo_push(&radio->tx_fifo[pipe], p_payload, length))
+    {
+        return fail(NRF_GZLL_ERROR_CODE_ATTEMPTED_TO_ADD_TO_FULL_FIFO);
+    }
+    ++radio->stats.packets_queued;
+    start_attempt(radio);
+    return true;
+}
+
+bool nrf_gzll_fetch_packet_from_rx_fifo(uint32_t pipe, uint8_t * p_payload, uint32_t * p_length)
+{
+    sim_radio_t* radio = current_radio();
+
+    sim_charge(SIM_ACCESS_COST);
+    if (pipe >= NRF_GZLL_CONST_PIPE_COUNT)
+    {
+        return fail(NRF_GZLL_ERROR_CODE_INVALID_PIPE);
+    }
+
+    packet_t* packet = fifo_front(&radio->rx_fifo[pipe]);
+    if (packet == NULL)
+    {
+        return fail(NRF_GZLL_ERROR_CODE_ATTEMPTED_TO_FETCH_FROM_EMPTY_FIFO);
+    }
+    if (packet->length > *p_length)
+    {
+        return fail(NRF_GZLL_ERROR_CODE_RX_BUFFER_TOO_SMALL);
+    }
+    memcpy(p_payload, packet->data, packet->length);
+    *p_length = packet->length;
+    fifo_pop(&radio->rx_fifo[pipe]);
+    return true;
+}
+
+int32_t nrf_gzll_get_tx_fifo_packet_count(uint32_t pipe)
+{
+    sim_charge(SIM_ACCESS_COST);
+    return pipe < NRF_GZLL_CONST_PIPE_COUNT ? (int32_t) current_radio()->tx_fifo[pipe].count : -1;
+}
+
+int32_t nrf_gzll_get_rx_fifo_packet_count(uint32_t pipe)
+{
+    sim_charge(SIM_ACCESS_COST);
+    return pipe < NRF_GZLL_CONST_PIPE_COUNT ? (int32_t) current_radio()->rx_fifo[pipe].count : -1;
+}
+
+bool nrf_gzll_flush_tx_fifo(uint32_t pipe)
+{
+    sim_radio_t* radio = current_radio();
+
+    sim_charge(SIM_ACCESS_COST);
+    if (pipe >= NRF_GZLL_CONST_PIPE_COUNT)
+    {
+        return fail(NRF_GZLL_ERROR_CODE_INVALID_PIPE);
+    }
+    if (radio->transmitting && radio->tx_pipe == pipe)
+    {
+        radio->transmitting = false;
+    }
+    radio->stats.tx_flushed += radio->tx_fifo[pipe].count;
+    radio->tx_fifo[pipe].count = 0;
+    return true;
+}
+
+bool nrf_gzll_flush_rx_fifo(uint32_t pipe)
+{
+    sim_radio_t* radio = current_radio();
+
+    sim_charge(SIM_ACCESS_COST);
+    if (pipe >= NRF_GZLL_CONST_PIPE_COUNT)
+    {
+        return fail(NRF_GZLL_ERROR_CODE_INVALID_PIPE);
+    }
+    radio->stats.rx_flushed += radio->rx_fifo[pipe].count;
+    radio->rx_fifo[pipe].count = 0;
+    return true;
+}
+
+nrf_gzll_error_code_t nrf_gzll_get_error_code(void)
+{
+    return nrf_gzll_error_code;
+}
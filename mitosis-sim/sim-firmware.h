@@ -0,0 +1,18 @@
+/*
+    Force-included into the firmware's main.c by the simulator build.
+
+    The firmware busy-polls in places where the real chip would spend
+    cycles; code that never touches a peripheral would otherwise spin
+    without advancing the virtual clock. Charge those polls here.
+*/
+
+#ifndef _MITOSIS_SIM_FIRMWARE_H
+#define _MITOSIS_SIM_FIRMWARE_H
+
+#include "sim.h"
+#include "mitosis-crypto-queue.h"
+
+#define mitosis_crypto_queue_peek(queue) \
+    (sim_charge(SIM_POLL_COST), mitosis_crypto_queue_peek(queue))
+
+#endif
@@ -0,0 +1,1098 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include "nrf.h"
+#include "nrf_gpio.h"
+#include "nrf_delay.h"
+#include "nrf_drv_clock.h"
+#include "nrf_drv_rtc.h"
+#include "nrf_drv_uart.h"
+#include "app_uart.h"
+#include "app_error.h"
+#include "mitosis-aes-ecb.h"
+#include "sim.h"
+
+#define SIM_MAX_DEVICES 4
+#define SIM_STACK_SIZE (256 * 1024)
+#define SIM_RTC_COUNT 2
+#define SIM_RTC_CC_COUNT 4
+#define SIM_UART_RX_SIZE 64
+// Thread mode runs below every interrupt priority.
+#define THREAD_PRIORITY 4
+#define NEVER UINT64_MAX
+
+typedef struct _sim_rtc_t {
+    nrf_drv_rtc_handler_t handler;
+    uint16_t prescaler;
+    bool tick_enabled;
+    bool running;
+    sim_time_t started;
+    uint64_t ticks;
+    sim_time_t next_tick;
+    // COUNTER carries on from where it was stopped, unlike the tick times.
+    uint32_t counter;
+    uint32_t cc[SIM_RTC_CC_COUNT];
+    uint8_t cc_enabled;
+    // Interrupts waiting for the handler, one bit per nrf_drv_rtc_int_type_t.
+    uint8_t events;
+} sim_rtc_t;
+
+struct _sim_device_t {
+    size_t index;
+    const sim_firmware_t* firmware;
+    ucontext_t context;
+    sim_time_t time;
+    bool sleeping;
+    bool finished;
+    // Time spent awake and the number of times the device woke from
+    // __WFE(), as a stand-in for current draw.
+    sim_device_stats_t stats;
+    sim_time_t awake_since;
+
+    // Core state.
+    bool primask;
+    bool event_register;
+    int execution_priority;
+    uint32_t ipsr;
+    uint32_t irq_enabled;
+    uint32_t irq_pending;
+    uint8_t irq_priority[SIM_IRQ_COUNT];
+
+    // Peripherals.
+    NRF_GPIO_Type gpio;
+    NRF_GPIOTE_Type gpiote;
+    NRF_RNG_Type rng;
+    NRF_ECB_Type ecb;
+    NRF_TIMER_Type timer0;
+    uint32_t sense_high;
+    uint32_t sense_low;
+    bool detect;
+    bool has_matrix;
+    sim_matrix_t matrix;
+    bool keys[SIM_MATRIX_ROWS][SIM_MATRIX_COLUMNS];
+    bool rng_running;
+    sim_time_t rng_next;
+    bool ecb_running;
+    sim_time_t ecb_done;
+    // TIMER0 only counts in timer mode, so the count is worked out from the
+    // time it has been running.
+    bool timer0_running;
+    sim_time_t timer0_started;
+    sim_time_t timer0_elapsed;
+    sim_rtc_t rtc[SIM_RTC_COUNT];
+
+    app_uart_event_handler_t uart_handler;
+    uint8_t uart_rx[SIM_UART_RX_SIZE];
+    size_t uart_rx_head;
+    size_t uart_rx_count;
+    sim_uart_sink_t uart_sink;
+    void* uart_sink_user;
+
+    sim_radio_t* radio;
+    // The firmware's .data as it was before main() first ran.
+    uint8_t* data_image;
+};
+
+typedef struct _sim_event_t {
+    sim_time_t when;
+    uint64_t sequence;
+    sim_event_fn_t fn;
+    void* user;
+} sim_event_t;
+
+static uint8_t device_stacks[SIM_MAX_DEVICES][SIM_STACK_SIZE] __attribute__((aligned(16)));
+static sim_device_t devices[SIM_MAX_DEVICES];
+static size_t device_count = 0;
+static sim_device_t* current = NULL;
+static ucontext_t scheduler_context;
+
+static sim_event_t* events = NULL;
+static size_t event_count = 0;
+static size_t event_capacity = 0;
+static uint64_t event_sequence = 0;
+
+static sim_time_t now = 0;
+static uint64_t random_state = 0;
+// The RNG peripherals draw from their own stream, so how much firmware
+// uses them doesn't change what the typist does.
+static uint64_t rng_random_state = 0;
+
+/*
+    Event queue: a binary min-heap ordered by time, then insertion order.
+*/
+static bool event_before(const sim_event_t* a, const sim_event_t* b)
+{
+    return a->when < b->when || (a->when == b->when && a->sequence < b->sequence);
+}
+
+void sim_schedule(sim_time_t when, sim_event_fn_t fn, void* user)
+{
+    if (event_count == event_capacity)
+    {
+        event_capacity = event_capacity ? event_capacity * 2 : 64;
+        events = realloc(events, event_capacity * sizeof(*events));
+        if (events == NULL)
+        {
+            abort();
+        }
+    }
+
+    size_t idx = event_count++;
+    sim_event_t event = { when, event_sequence++, fn, user };
+    while (idx > 0 && event_before(&event, &events[(idx - 1) / 2]))
+    {
+        events[idx] = events[(idx - 1) / 2];
+        idx = (idx - 1) / 2;
+    }
+    events[idx] = event;
+}
+
+static sim_event_t pop_event(void)
+{
+    sim_event_t top = events[0];
+    sim_event_t last = events[--event_count];
+    size_t idx = 0;
+
+    for (;;)
+    {
+        size_t child = idx * 2 + 1;
+        if (child >= event_count)
+        {
+            break;
+        }
+        if (child + 1 < event_count && event_before(&events[child + 1], &events[child]))
+        {
+            ++child;
+        }
+        if (!event_before(&events[child], &last))
+        {
+            break;
+        }
+        events[idx] = events[child];
+        idx = child;
+    }
+    if (event_count > 0)
+    {
+        events[idx] = last;
+    }
+    return top;
+}
+
+static sim_time_t next_event_time(void)
+{
+    return event_count ? events[0].when : NEVER;
+}
+
+/*
+    Setup.
+*/
+void sim_init(uint64_t seed)
+{
+    memset(devices, 0, sizeof(devices));
+    device_count = 0;
+    current = NULL;
+    event_count = 0;
+    event_sequence = 0;
+    now = 0;
+    random_state = seed ? seed : 1;
+    rng_random_state = ~random_state ? ~random_state : 1;
+}
+
+// xorshift64*; deterministic for a given seed.
+uint64_t sim_random(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t rng_random(void)
+{
+    rng_random_state ^= rng_random_state >> 12;
+    rng_random_state ^= rng_random_state << 25;
+    rng_random_state ^= rng_random_state >> 27;
+    return rng_random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void device_entry(void)
+{
+    current->firmware->main();
+    // Firmware main() never returns on hardware; park the device if it does.
+    current->finished = true;
+    for (;;)
+    {
+        current->sleeping = true;
+        swapcontext(&current->context, &scheduler_context);
+    }
+}
+
+// Sets up a device to run main() from the top on its own stack.
+static void start_device(sim_device_t* device)
+{
+    device->execution_priority = THREAD_PRIORITY;
+
+    getcontext(&device->context);
+    device->context.uc_stack.ss_sp = device_stacks[device->index];
+    device->context.uc_stack.ss_size = SIM_STACK_SIZE;
+    device->context.uc_link = NULL;
+    makecontext(&device->context, device_entry, 0);
+}
+
+sim_device_t* sim_add_device(const sim_firmware_t* firmware)
+{
+    if (device_count == SIM_MAX_DEVICES)
+    {
+        fprintf(stderr, "sim: too many devices\n");
+        abort();
+    }
+
+    sim_device_t* device = &devices[device_count];
+    size_t data_size = firmware->data_end - firmware->data_start;
+
+    device->index = device_count++;
+    device->firmware = firmware;
+    device->time = now;
+    device->radio = sim_radio_create(device);
+    device->data_image = malloc(data_size ? data_size : 1);
+    if (device->data_image == NULL)
+    {
+        abort();
+    }
+    memcpy(device->data_image, firmware->data_start, data_size);
+    start_device(device);
+    return device;
+}
+
+void sim_restart_device(sim_device_t* device)
+{
+    sim_device_t saved = *device;
+    const sim_firmware_t* firmware = device->firmware;
+
+    // Only what's outside the chip survives: the keys held down, the wiring,
+    // and the simulator's own bookkeeping. Pending peripheral events find
+    // their peripheral stopped and are ignored.
+    memset(device, 0, sizeof(*device));
+    device->index = saved.index;
+    device->firmware = saved.firmware;
+    device->time = saved.time > now ? saved.time : now;
+    device->stats = saved.stats;
+    if (!saved.sleeping)
+    {
+        device->stats.awake += saved.time - saved.awake_since;
+    }
+    device->awake_since = device->time;
+    device->has_matrix = saved.has_matrix;
+    device->matrix = saved.matrix;
+    memcpy(device->keys, saved.keys, sizeof(device->keys));
+    device->uart_sink = saved.uart_sink;
+    device->uart_sink_user = saved.uart_sink_user;
+    device->radio = saved.radio;
+    device->data_image = saved.data_image;
+
+    memcpy(firmware->data_start, device->data_image, firmware->data_end - firmware->data_start);
+    memset(firmware->bss_start, 0, firmware->bss_end - firmware->bss_start);
+    sim_radio_reset(device->radio);
+    start_device(device);
+}
+
+void sim_attach_matrix(sim_device_t* device, const sim_matrix_t* matrix)
+{
+    device->matrix = *matrix;
+    device->has_matrix = true;
+}
+
+void sim_set_uart_sink(sim_device_t* device, sim_uart_sink_t sink, void* user)
+{
+    device->uart_sink = sink;
+    device->uart_sink_user = user;
+}
+
+sim_device_t* sim_current(void)
+{
+    return current;
+}
+
+sim_device_t* sim_device_at(size_t index)
+{
+    return index < device_count ? &devices[index] : NULL;
+}
+
+size_t sim_device_count(void)
+{
+    return device_count;
+}
+
+const char* sim_device_name(const sim_device_t* device)
+{
+    return device->firmware->name;
+}
+
+void sim_device_stats(const sim_device_t* device, sim_device_stats_t* stats)
+{
+    *stats = device->stats;
+    if (!device->sleeping)
+    {
+        stats->awake += device->time - device->awake_since;
+    }
+}
+
+const sim_firmware_t* sim_device_firmware(const sim_device_t* device)
+{
+    return device->firmware;
+}
+
+sim_radio_t* sim_device_radio(sim_device_t* device)
+{
+    return device->radio;
+}
+
+sim_time_t sim_now(void)
+{
+    return current ? current->time : now;
+}
+
+/*
+    Scheduling. A device may run until its clock passes the next event or
+    the clock of another device that is awake, so nothing it does can be
+    observed out of order.
+*/
+static sim_time_t horizon(const sim_device_t* device)
+{
+    sim_time_t limit = next_event_time();
+    for (size_t idx = 0; idx < device_count; ++idx)
+    {
+        const sim_device_t* other = &devices[idx];
+        if (other != device && !other->sleeping && other->time < limit)
+        {
+            limit = other->time;
+        }
+    }
+    return limit;
+}
+
+static void yield(void)
+{
+    swapcontext(&current->context, &scheduler_context);
+}
+
+static void run_irq(sim_device_t* device, int irq);
+static void poll_tasks(sim_device_t* device);
+
+static int next_irq(const sim_device_t* device)
+{
+    uint32_t ready = device->irq_pending & device->irq_enabled;
+    int best = -1;
+
+    for (int irq = 0; ready != 0; ++irq, ready >>= 1)
+    {
+        if ((ready & 1) && device->irq_priority[irq] < device->execution_priority &&
+            (best < 0 || device->irq_priority[irq] < device->irq_priority[best]))
+        {
+            best = irq;
+        }
+    }
+    return best;
+}
+
+static void dispatch_interrupts(sim_device_t* device)
+{
+    int irq;
+
+    while (!device->primask && (irq = next_irq(device)) >= 0)
+    {
+        int saved_priority = device->execution_priority;
+        uint32_t saved_ipsr = device->ipsr;
+
+        device->irq_pending &= ~(1UL << irq);
+        device->execution_priority = device->irq_priority[irq];
+        device->ipsr = 16 + irq;
+        run_irq(device, irq);
+        device->execution_priority = saved_priority;
+        device->ipsr = saved_ipsr;
+        // Returning from an exception sets the event register, so a
+        // following __WFE() doesn't sleep through the work it queued.
+        device->event_register = true;
+    }
+}
+
+void sim_charge(sim_time_t cost)
+{
+    sim_device_t* device = current;
+    if (device == NULL)
+    {
+        return;
+    }
+
+    device->time += cost;
+    while (device->time > horizon(device))
+    {
+        yield();
+    }
+    poll_tasks(device);
+    dispatch_interrupts(device);
+}
+
+void sim_sleep_until_event(void)
+{
+    sim_device_t* device = current;
+
+    if (next_irq(device) < 0)
+    {
+        device->sleeping = true;
+        device->stats.awake += device->time - device->awake_since;
+        yield();
+        device->awake_since = device->time;
+        ++device->stats.wakeups;
+    }
+    dispatch_interrupts(device);
+    // Waking consumes the event.
+    device->event_register = false;
+}
+
+void sim_pend_irq(sim_device_t* device, int irq)
+{
+    device->irq_pending |= 1UL << irq;
+    if (device->sleeping && !device->finished && next_irq(device) >= 0)
+    {
+        device->sleeping = false;
+        if (device->time < now)
+        {
+            device->time = now;
+        }
+    }
+}
+
+void sim_run_until(sim_time_t end)
+{
+    for (;;)
+    {
+        sim_device_t* next = NULL;
+        for (size_t idx = 0; idx < device_count; ++idx)
+        {
+            sim_device_t* device = &devices[idx];
+            if (!device->sleeping && (next == NULL || device->time < next->time))
+            {
+                next = device;
+            }
+        }
+
+        sim_time_t event_time = next_event_time();
+        if (event_time <= end && (next == NULL || event_time <= next->time))
+        {
+            sim_event_t event = pop_event();
+            now = event.when;
+            event.fn(event.user);
+        }
+        else if (next != NULL && next->time <= end)
+        {
+            if (now < next->time)
+            {
+                now = next->time;
+            }
+            current = next;
+            swapcontext(&scheduler_context, &next->context);
+            current = NULL;
+        }
+        else
+        {
+            break;
+        }
+    }
+    now = end;
+}
+
+/*
+    Core and NVIC.
+*/
+void __WFE(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    if (current->event_register)
+    {
+        current->event_register = false;
+        return;
+    }
+    sim_sleep_until_event();
+}
+
+void __WFI(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    sim_sleep_until_event();
+}
+
+void __SEV(void)
+{
+    current->event_register = true;
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void __NOP(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void __disable_irq(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    current->primask = true;
+}
+
+void __enable_irq(void)
+{
+    current->primask = false;
+    sim_charge(SIM_ACCESS_COST);
+}
+
+uint32_t __get_PRIMASK(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    return current->primask;
+}
+
+void __set_PRIMASK(uint32_t primask)
+{
+    current->primask = primask & 1;
+    sim_charge(SIM_ACCESS_COST);
+}
+
+uint32_t __get_IPSR(void)
+{
+    return current->ipsr;
+}
+
+void NVIC_EnableIRQ(IRQn_Type irq)
+{
+    current->irq_enabled |= 1UL << irq;
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void NVIC_DisableIRQ(IRQn_Type irq)
+{
+    current->irq_enabled &= ~(1UL << irq);
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority)
+{
+    current->irq_priority[irq] = priority & 3;
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type irq)
+{
+    current->irq_pending |= 1UL << irq;
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type irq)
+{
+    current->irq_pending &= ~(1UL << irq);
+    sim_charge(SIM_ACCESS_COST);
+}
+
+/*
+    GPIO and GPIOTE. Keyboard halves have a key matrix attached: a column
+    input reads high while a row driving it high has that key pressed.
+*/
+static void port_event(void* user)
+{
+    sim_device_t* device = user;
+
+    device->gpiote.EVENTS_PORT = 1;
+    if (device->gpiote.INTENSET & GPIOTE_INTENSET_PORT_Msk)
+    {
+        sim_pend_irq(device, GPIOTE_IRQn);
+    }
+}
+
+static void update_gpio(sim_device_t* device)
+{
+    uint32_t in = 0;
+
+    if (device->has_matrix)
+    {
+        for (int row = 0; row < SIM_MATRIX_ROWS; ++row)
+        {
+            if (!(device->gpio.OUT & (1UL << device->matrix.row_pins[row])))
+            {
+                continue;
+            }
+            for (int column = 0; column < SIM_MATRIX_COLUMNS; ++column)
+            {
+                if (device->keys[row][column])
+                {
+                    in |= 1UL << device->matrix.column_pins[column];
+                }
+            }
+        }
+    }
+    device->gpio.IN = in;
+
+    // PORT fires on the rising edge of DETECT, a little later. The delay
+    // matters: scanning a held key raises DETECT, and the row has to be
+    // read before the GPIOTE handler gets in and clears it.
+    bool detect = (in & device->sense_high) != 0 || (~in & device->sense_low) != 0;
+    if (detect && !device->detect)
+    {
+        sim_schedule(sim_now() + SIM_GPIOTE_LATENCY, port_event, device);
+    }
+    device->detect = detect;
+}
+
+NRF_GPIO_Type* sim_nrf_gpio(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    update_gpio(current);
+    return &current->gpio;
+}
+
+NRF_GPIOTE_Type* sim_nrf_gpiote(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    return &current->gpiote;
+}
+
+void nrf_gpio_cfg_sense_input(uint32_t pin_number, nrf_gpio_pin_pull_t pull_config, nrf_gpio_pin_sense_t sense_config)
+{
+    current->gpio.DIR &= ~(1UL << pin_number);
+    current->gpio.PIN_CNF[pin_number] = (sense_config << 16) | (pull_config << 2);
+    current->sense_high &= ~(1UL << pin_number);
+    current->sense_low &= ~(1UL << pin_number);
+    if (sense_config == NRF_GPIO_PIN_SENSE_HIGH)
+    {
+        current->sense_high |= 1UL << pin_number;
+    }
+    else if (sense_config == NRF_GPIO_PIN_SENSE_LOW)
+    {
+        current->sense_low |= 1UL << pin_number;
+    }
+    update_gpio(current);
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void nrf_gpio_cfg_output(uint32_t pin_number)
+{
+    current->gpio.DIR |= 1UL << pin_number;
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void nrf_gpio_pin_set(uint32_t pin_number)
+{
+    current->gpio.OUT |= 1UL << pin_number;
+    update_gpio(current);
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void nrf_gpio_pin_clear(uint32_t pin_number)
+{
+    current->gpio.OUT &= ~(1UL << pin_number);
+    update_gpio(current);
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void sim_set_key(sim_device_t* device, int row, int column, bool pressed)
+{
+    device->keys[row][column] = pressed;
+    update_gpio(device);
+}
+
+/*
+    RNG and ECB. Tasks are plain register writes, so they're picked up the
+    next time the device touches the simulator.
+*/
+static void rng_value_ready(void* user)
+{
+    sim_device_t* device = user;
+
+    if (!device->rng_running || now != device->rng_next)
+    {
+        return;
+    }
+    device->rng.VALUE = (uint8_t) rng_random();
+    device->rng.EVENTS_VALRDY = 1;
+    if (device->rng.INTENSET & RNG_INTENSET_VALRDY_Msk)
+    {
+        sim_pend_irq(device, RNG_IRQn);
+    }
+    device->rng_next = now + SIM_RNG_VALUE_TIME;
+    sim_schedule(device->rng_next, rng_value_ready, device);
+}
+
+static void ecb_done(void* user)
+{
+    sim_device_t* device = user;
+
+    if (!device->ecb_running || now != device->ecb_done)
+    {
+        return;
+    }
+    device->ecb_running = false;
+    // The real peripheral works on a snapshot of the key and plaintext; the
+    // host backend is close enough since nothing else touches the block.
+    mitosis_aes_ecb_encrypt((mitosis_aes_ecb_context_t*) device->ecb.ECBDATAPTR);
+    device->ecb.EVENTS_ENDECB = 1;
+    if (device->ecb.INTENSET & ECB_INTENSET_ENDECB_Msk)
+    {
+        sim_pend_irq(device, ECB_IRQn);
+    }
+}
+
+static uint32_t timer0_count(const sim_device_t* device)
+{
+    sim_time_t elapsed = device->timer0_elapsed;
+
+    if (device->timer0_running)
+    {
+        elapsed += device->time - device->timer0_started;
+    }
+    // PRESCALER divides the 16MHz clock by 2^PRESCALER.
+    return (uint32_t) (elapsed * 16 / SIM_US(1) >> device->timer0.PRESCALER);
+}
+
+static void poll_timer(sim_device_t* device)
+{
+    NRF_TIMER_Type* timer = &device->timer0;
+
+    if (timer->TASKS_START)
+    {
+        timer->TASKS_START = 0;
+        if (!device->timer0_running)
+        {
+            device->timer0_running = true;
+            device->timer0_started = device->time;
+        }
+    }
+    if (timer->TASKS_STOP)
+    {
+        timer->TASKS_STOP = 0;
+        if (device->timer0_running)
+        {
+            device->timer0_running = false;
+            device->timer0_elapsed += device->time - device->timer0_started;
+        }
+    }
+    if (timer->TASKS_CLEAR)
+    {
+        timer->TASKS_CLEAR = 0;
+        device->timer0_elapsed = 0;
+        device->timer0_started = device->time;
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        if (timer->TASKS_CAPTURE[i])
+        {
+            timer->TASKS_CAPTURE[i] = 0;
+            timer->CC[i] = timer0_count(device);
+        }
+    }
+}
+
+static void poll_tasks(sim_device_t* device)
+{
+    if (device->rng.TASKS_START)
+    {
+        device->rng.TASKS_START = 0;
+        if (!device->rng_running)
+        {
+            device->rng_running = true;
+            device->rng_next = device->time + SIM_RNG_VALUE_TIME;
+            sim_schedule(device->rng_next, rng_value_ready, device);
+        }
+    }
+    if (device->rng.TASKS_STOP)
+    {
+        device->rng.TASKS_STOP = 0;
+        device->rng_running = false;
+    }
+    if (device->ecb.TASKS_STOPECB)
+    {
+        device->ecb.TASKS_STOPECB = 0;
+        if (device->ecb_running)
+        {
+            device->ecb_running = false;
+            device->ecb.EVENTS_ERRORECB = 1;
+            if (device->ecb.INTENSET & ECB_INTENSET_ERRORECB_Msk)
+            {
+                sim_pend_irq(device, ECB_IRQn);
+            }
+        }
+    }
+    if (device->ecb.TASKS_STARTECB)
+    {
+        device->ecb.TASKS_STARTECB = 0;
+        device->ecb_running = true;
+        device->ecb_done = device->time + SIM_ECB_BLOCK_TIME;
+        sim_schedule(device->ecb_done, ecb_done, device);
+    }
+    poll_timer(device);
+}
+
+NRF_RNG_Type* sim_nrf_rng(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    return &current->rng;
+}
+
+NRF_ECB_Type* sim_nrf_ecb(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    return &current->ecb;
+}
+
+NRF_TIMER_Type* sim_nrf_timer0(void)
+{
+    sim_charge(SIM_ACCESS_COST);
+    return &current->timer0;
+}
+
+/*
+    Clock, delay and RTC drivers.
+*/
+ret_code_t nrf_drv_clock_init(void)
+{
+    return NRF_SUCCESS;
+}
+
+void nrf_drv_clock_lfclk_request(nrf_drv_clock_handler_t handler)
+{
+}
+
+void nrf_delay_us(uint32_t number_of_us)
+{
+    // Busy-wait in small steps so interrupts still land on time.
+    for (uint32_t us = 0; us < number_of_us; ++us)
+    {
+        sim_charge(SIM_US(1));
+    }
+}
+
+void nrf_delay_ms(uint32_t number_of_ms)
+{
+    while (number_of_ms--)
+    {
+        nrf_delay_us(1000);
+    }
+}
+
+static const IRQn_Type rtc_irqs[SIM_RTC_COUNT] = { RTC0_IRQn, RTC1_IRQn };
+
+// Time of the nth tick after the RTC was started, from the 32.768kHz clock.
+static sim_time_t rtc_tick_time(const sim_rtc_t* rtc, uint64_t tick)
+{
+    return rtc->started + (tick * (rtc->prescaler + 1) * 1000000000ULL) / RTC_INPUT_FREQ;
+}
+
+static void rtc_tick(void* user)
+{
+    sim_rtc_t* rtc = user;
+    sim_device_t* device = &devices[0];
+
+    // Find the owner; stale ticks from before a disable are ignored.
+    for (size_t idx = 0; idx < device_count; ++idx)
+    {
+        if (rtc >= devices[idx].rtc && rtc < devices[idx].rtc + SIM_RTC_COUNT)
+        {
+            device = &devices[idx];
+        }
+    }
+    if (!rtc->running || now != rtc->next_tick)
+    {
+        return;
+    }
+    rtc->counter = RTC_WRAP(rtc->counter + 1);
+    if (rtc->tick_enabled)
+    {
+        rtc->events |= 1 << NRF_DRV_RTC_INT_TICK;
+    }
+    for (int channel = 0; channel < SIM_RTC_CC_COUNT; ++channel)
+    {
+        // Like the SDK driver, a compare interrupt only fires once.
+        if (((rtc->cc_enabled >> channel) & 1) && rtc->cc[channel] == rtc->counter)
+        {
+            rtc->cc_enabled &= ~(1 << channel);
+            rtc->events |= 1 << (NRF_DRV_RTC_INT_COMPARE0 + channel);
+        }
+    }
+    if (rtc->events)
+    {
+        sim_pend_irq(device, rtc_irqs[rtc - device->rtc]);
+    }
+    rtc->next_tick = rtc_tick_time(rtc, ++rtc->ticks);
+    sim_schedule(rtc->next_tick, rtc_tick, rtc);
+}
+
+ret_code_t nrf_drv_rtc_init(nrf_drv_rtc_t const * const p_instance, nrf_drv_rtc_config_t const * p_config, nrf_drv_rtc_handler_t handler)
+{
+    sim_rtc_t* rtc = &current->rtc[p_instance->instance_id];
+
+    memset(rtc, 0, sizeof(*rtc));
+    rtc->handler = handler;
+    rtc->prescaler = p_config ? p_config->prescaler : p_instance->prescaler;
+    current->irq_priority[rtc_irqs[p_instance->instance_id]] = APP_IRQ_PRIORITY_LOW;
+    current->irq_enabled |= 1UL << rtc_irqs[p_instance->instance_id];
+    sim_charge(SIM_ACCESS_COST);
+    return NRF_SUCCESS;
+}
+
+void nrf_drv_rtc_enable(nrf_drv_rtc_t const * const p_instance)
+{
+    sim_rtc_t* rtc = &current->rtc[p_instance->instance_id];
+
+    if (!rtc->running)
+    {
+        rtc->running = true;
+        rtc->started = current->time;
+        rtc->ticks = 1;
+        rtc->next_tick = rtc_tick_time(rtc, rtc->ticks);
+        sim_schedule(rtc->next_tick, rtc_tick, rtc);
+    }
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void nrf_drv_rtc_disable(nrf_drv_rtc_t const * const p_instance)
+{
+    current->rtc[p_instance->instance_id].running = false;
+    current->rtc[p_instance->instance_id].events = 0;
+    current->irq_pending &= ~(1UL << rtc_irqs[p_instance->instance_id]);
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void nrf_drv_rtc_tick_enable(nrf_drv_rtc_t const * const p_instance, bool enable_irq)
+{
+    current->rtc[p_instance->instance_id].tick_enabled = enable_irq;
+    sim_charge(SIM_ACCESS_COST);
+}
+
+void nrf_drv_rtc_tick_disable(nrf_drv_rtc_t const * const p_instance)
+{
+    current->rtc[p_instance->instance_id].tick_enabled = false;
+    sim_charge(SIM_ACCESS_COST);
+}
+
+ret_code_t nrf_drv_rtc_cc_set(nrf_drv_rtc_t const * const p_instance, uint32_t channel, uint32_t val, bool enable_irq)
+{
+    sim_rtc_t* rtc = &current->rtc[p_instance->instance_id];
+
+    rtc->cc[channel] = RTC_WRAP(val);
+    if (enable_irq)
+    {
+        rtc->cc_enabled |= 1 << channel;
+    }
+    sim_charge(SIM_ACCESS_COST);
+    return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_rtc_cc_disable(nrf_drv_rtc_t const * const p_instance, uint32_t channel)
+{
+    sim_rtc_t* rtc = &current->rtc[p_instance->instance_id];
+
+    rtc->cc_enabled &= ~(1 << channel);
+    rtc->events &= ~(1 << (NRF_DRV_RTC_INT_COMPARE0 + channel));
+    sim_charge(SIM_ACCESS_COST);
+    return NRF_SUCCESS;
+}
+
+uint32_t nrf_drv_rtc_counter_get(nrf_drv_rtc_t const * const p_instance)
+{
+    sim_charge(SIM_ACCESS_COST);
+    return current->rtc[p_instance->instance_id].counter;
+}
+
+/*
+    UART.
+*/
+uint32_t app_uart_init(const app_uart_comm_params_t * p_comm_params,
+                       app_uart_buffers_t * p_buffers,
+                       app_uart_event_handler_t error_handler,
+                       uint32_t irq_priority)
+{
+    current->uart_handler = error_handler;
+    current->irq_priority[UART0_IRQn] = irq_priority;
+    current->irq_enabled |= 1UL << UART0_IRQn;
+    sim_charge(SIM_ACCESS_COST);
+    return NRF_SUCCESS;
+}
+
+ret_code_t nrf_drv_uart_tx(uint8_t const * const p_data, uint8_t length)
+{
+    if (current->uart_sink != NULL)
+    {
+        current->uart_sink(current, p_data, length, current->time + length * SIM_UART_BYTE_TIME, current->uart_sink_user);
+    }
+    sim_charge(SIM_ACCESS_COST);
+    return NRF_SUCCESS;
+}
+
+void sim_uart_receive(sim_device_t* device, uint8_t byte)
+{
+    if (device->uart_rx_count == SIM_UART_RX_SIZE)
+    {
+        // Overrun; the byte is lost just as it would be on the wire.
+        return;
+    }
+    device->uart_rx[(device->uart_rx_head + device->uart_rx_count++) % SIM_UART_RX_SIZE] = byte;
+    sim_pend_irq(device, UART0_IRQn);
+}
+
+static void uart_irq(sim_device_t* device)
+{
+    while (device->uart_rx_count > 0)
+    {
+        app_uart_evt_t event = { .evt_type = APP_UART_DATA };
+        event.data.value = device->uart_rx[device->uart_rx_head];
+        device->uart_rx_head = (device->uart_rx_head + 1) % SIM_UART_RX_SIZE;
+        --device->uart_rx_count;
+        if (device->uart_handler != NULL)
+        {
+            device->uart_handler(&event);
+        }
+    }
+}
+
+void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t * p_file_name)
+{
+    fprintf(stderr, "sim: %s: app error %u at %s:%u\n",
+        current ? sim_device_name(current) : "?", error_code, p_file_name, line_num);
+    abort();
+}
+
+static void run_irq(sim_device_t* device, int irq)
+{
+    switch (irq)
+    {
+        case RADIO_IRQn:
+            sim_radio_irq(device);
+            break;
+        case UART0_IRQn:
+            uart_irq(device);
+            break;
+        case RTC0_IRQn:
+        case RTC1_IRQn:
+        {
+            sim_rtc_t* rtc = &device->rtc[irq == RTC0_IRQn ? 0 : 1];
+            uint8_t events = rtc->events;
+
+            // The SDK driver handles compares before the tick.
+            rtc->events = 0;
+            for (int type = NRF_DRV_RTC_INT_COMPARE0; type <= NRF_DRV_RTC_INT_TICK; ++type)
+            {
+                if (((events >> type) & 1) && rtc->handler != NULL)
+                {
+                    rtc->handler(type);
+                }
+            }
+            break;
+        }
+        default:
+            if (device->firmware->irq_handlers[irq] != NULL)
+            {
+                device->firmware->irq_handlers[irq]();
+            }
+            break;
+    }
+}
@@ -0,0 +1,186 @@
+/*
+    Host simulator for the mitosis firmware.
+
+    Each firmware image (keyboard halves, receiver) is built into its own
+    partially linked object with every symbol but its sim_firmware_t made
+    local, so the images keep separate globals just like separate chips.
+    They run as coroutines on a shared virtual clock: firmware code takes no
+    time except where the simulator charges it (peripheral accesses,
+    intrinsics, delays, ECB blocks), and a device only runs ahead of the
+    others until the next scheduled event. Runs are fully deterministic.
+*/
+
+#ifndef _MITOSIS_SIM_H
+#define _MITOSIS_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nrf_gzll.h"
+
+#define SIM_IRQ_COUNT 32
+
+// Virtual time in nanoseconds.
+typedef uint64_t sim_time_t;
+
+#define SIM_US(us) ((sim_time_t)((us) * 1000))
+#define SIM_MS(ms) ((sim_time_t)((ms) * 1000000))
+
+typedef void (*sim_irq_handler_t)(void);
+
+// Exported by each firmware image (see firmware.c).
+typedef struct _sim_firmware_t {
+    const char* name;
+    int (*main)(void);
+    // Interrupt handlers the firmware may define itself. Lines owned by a
+    // simulated SDK driver (RADIO, UART0, RTC0/1) are handled by the core.
+    sim_irq_handler_t irq_handlers[SIM_IRQ_COUNT];
+    // Gazell callbacks.
+    void (*gzll_device_tx_success)(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info);
+    void (*gzll_device_tx_failed)(uint32_t pipe, nrf_gzll_device_tx_info_t tx_info);
+    void (*gzll_host_rx_data_ready)(uint32_t pipe, nrf_gzll_host_rx_info_t rx_info);
+    void (*gzll_disabled)(void);
+    // The image's writable globals, so it can be restarted from scratch.
+    uint8_t* data_start;
+    uint8_t* data_end;
+    uint8_t* bss_start;
+    uint8_t* bss_end;
+} sim_firmware_t;
+
+typedef struct _sim_device_t sim_device_t;
+
+// Called from a device when it transmits bytes on its UART. done is when
+// the last byte has gone out on the wire.
+typedef void (*sim_uart_sink_t)(sim_device_t* device, const uint8_t* data, size_t length, sim_time_t done, void* user);
+
+// Called on the scheduler when a scheduled event fires.
+typedef void (*sim_event_fn_t)(void* user);
+
+// Key matrix wiring for a keyboard half: row outputs and column inputs.
+#define SIM_MATRIX_ROWS 5
+#define SIM_MATRIX_COLUMNS 7
+
+typedef struct _sim_matrix_t {
+    uint8_t row_pins[SIM_MATRIX_ROWS];
+    uint8_t column_pins[SIM_MATRIX_COLUMNS];
+} sim_matrix_t;
+
+/*
+    Simulation setup and driving.
+*/
+void sim_init(uint64_t seed);
+sim_device_t* sim_add_device(const sim_firmware_t* firmware);
+void sim_attach_matrix(sim_device_t* device, const sim_matrix_t* matrix);
+void sim_set_uart_sink(sim_device_t* device, sim_uart_sink_t sink, void* user);
+
+// Power cycles a device, for use from scheduled events: its globals and
+// peripherals go back to how they were at reset and main() runs again.
+// Anything it had queued on the radio is lost.
+void sim_restart_device(sim_device_t* device);
+
+// Runs every device and event up to the given time.
+void sim_run_until(sim_time_t end);
+
+sim_time_t sim_now(void);
+void sim_schedule(sim_time_t when, sim_event_fn_t fn, void* user);
+uint64_t sim_random(void);
+
+const char* sim_device_name(const sim_device_t* device);
+
+typedef struct _sim_device_stats_t {
+    uint32_t wakeups;
+    sim_time_t awake;
+} sim_device_stats_t;
+
+void sim_device_stats(const sim_device_t* device, sim_device_stats_t* stats);
+
+/*
+    Stimulus, for use from scheduled events.
+*/
+void sim_set_key(sim_device_t* device, int row, int column, bool pressed);
+void sim_uart_receive(sim_device_t* device, uint8_t byte);
+
+/*
+    Used by the simulated SDK and peripherals.
+*/
+sim_device_t* sim_current(void);
+void sim_charge(sim_time_t cost);
+void sim_pend_irq(sim_device_t* device, int irq);
+void sim_sleep_until_event(void);
+const sim_firmware_t* sim_device_firmware(const sim_device_t* device);
+
+sim_device_t* sim_device_at(size_t index);
+size_t sim_device_count(void);
+
+/*
+    Virtual radio (radio.c).
+*/
+typedef struct _sim_radio_t sim_radio_t;
+
+typedef struct _sim_radio_stats_t {
+    uint32_t packets_queued;
+    uint32_t tx_attempts;
+    uint32_t tx_success;
+    uint32_t tx_failed;
+    uint32_t ack_payloads_received;
+    uint32_t packets_received;
+    // Attempts that never reached the host, and ACKs that never made it back.
+    uint32_t packets_lost;
+    uint32_t acks_lost;
+    // Retransmissions of a packet the host already had, after a lost ACK.
+    uint32_t duplicates;
+    // Packets thrown away by nrf_gzll_flush_rx_fifo/flush_tx_fifo.
+    uint32_t rx_flushed;
+    uint32_t tx_flushed;
+    // Highest num_tx_attempts reported to the firmware.
+    uint16_t max_tx_attempts;
+} sim_radio_stats_t;
+
+// Loss on one direction of the link. Each attempt is lost with probability
+// loss, or burst_loss while in a burst (a Gilbert-Elliott channel); every
+// attempt enters a burst with probability burst_enter and leaves one with
+// burst_exit. All zero is a perfect link.
+typedef struct _sim_loss_t {
+    double loss;
+    double burst_loss;
+    double burst_enter;
+    double burst_exit;
+} sim_loss_t;
+
+typedef struct _sim_channel_t {
+    // Loss from device to host (data) and back (ACKs).
+    sim_loss_t data;
+    sim_loss_t ack;
+    // Each attempt takes attempt_time plus up to attempt_jitter.
+    sim_time_t attempt_time;
+    sim_time_t attempt_jitter;
+    // Overrides every device's nrf_gzll_set_max_tx_attempts(), if non-zero.
+    uint16_t max_tx_attempts;
+    // The channel has its own random stream, so changing it doesn't change
+    // anything else about a run.
+    uint64_t seed;
+} sim_channel_t;
+
+// Applies to every link. Call before the simulation starts.
+void sim_radio_set_channel(const sim_channel_t* channel);
+void sim_radio_default_channel(sim_channel_t* channel);
+
+sim_radio_t* sim_radio_create(sim_device_t* device);
+// Back to the state before nrf_gzll_init(), keeping the statistics.
+void sim_radio_reset(sim_radio_t* radio);
+sim_radio_t* sim_device_radio(sim_device_t* device);
+// Runs the Gazell callbacks queued for a device; called for RADIO_IRQn.
+void sim_radio_irq(sim_device_t* device);
+const sim_radio_stats_t* sim_radio_stats(sim_device_t* device);
+
+// Approximate costs of the things the simulator charges for.
+#define SIM_ACCESS_COST SIM_US(0.25)
+#define SIM_POLL_COST SIM_US(1)
+#define SIM_GPIOTE_LATENCY SIM_US(1)
+#define SIM_ECB_BLOCK_TIME SIM_US(7.2)
+#define SIM_RNG_VALUE_TIME SIM_US(167)
+#define SIM_UART_BYTE_TIME SIM_US(10)
+// Gazell's default timeslot; a device makes one attempt per timeslot.
+#define SIM_GZLL_ATTEMPT_TIME SIM_US(600)
+
+#endif